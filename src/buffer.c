@@ -1,20 +1,190 @@
 #include "buffer.h"
+#include "profile.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <wchar.h>
+#include <wctype.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+static Line *line_new_from_bytes(const char *bytes, size_t len) {
+    Line *lin = calloc(1, sizeof(Line));
+    if (lin == NULL)
+        return NULL;
+    if (len > 0) {
+        if (!line_reserve(lin, len)) {
+            free(lin);
+            return NULL;
+        }
+        memcpy(lin->data, bytes, len);
+    }
+    lin->bytes = len;
+    lin->size = utf8_length(bytes, len);
+    return lin;
+}
+
+static void line_free(Line *lin) {
+    free(lin->wrap_points);
+    if (lin->capacity > 0) {
+        line_release(lin->data);
+    }
+    free(lin);
+}
+
+static void line_release(char *data) {
+    size_t *refs = (size_t *)data - 1;
+    if (__atomic_sub_fetch(refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(refs);
+    }
+}
+
+static bool line_reserve(Line *lin, size_t bytes) {
+    // A save only holds a reference until it has written the line, see
+    // buffer_save_worker
+    size_t *refs = lin->capacity > 0 ? (size_t *)lin->data - 1 : NULL;
+    bool shared = refs != NULL && __atomic_load_n(refs, __ATOMIC_ACQUIRE) > 1;
+    if (lin->capacity > 0 && !shared && lin->capacity >= bytes)
+        return true;
+    // The current content is kept, even if the line is about to shrink
+    if (bytes < lin->bytes) {
+        bytes = lin->bytes;
+    }
+
+    size_t cap = lin->capacity > 0 ? lin->capacity : 16;
+    while (cap < bytes) {
+        cap *= 2;
+    }
+    if (refs != NULL && !shared) {
+        refs = realloc(refs, sizeof(size_t) + cap);
+    } else {
+        // Still pointing into 'file_data' (or empty) or part of a save that
+        // is being written, copy on write
+        refs = malloc(sizeof(size_t) + cap);
+        if (refs != NULL && lin->bytes > 0) {
+            memcpy(refs + 1, lin->data, lin->bytes);
+        }
+        if (refs != NULL && shared) {
+            line_release(lin->data);
+        }
+    }
+    if (refs == NULL)
+        return false;
+    *refs = 1;
+    lin->data = (char *)(refs + 1);
+    lin->capacity = cap;
+    return true;
+}
+
+static size_t line_count_around(const char *data, size_t bytes, size_t start,
+                                size_t end) {
+    // Only a character that is invalid on its own can become part of
+    // another one, it is at most three bytes in front of 'start'. The
+    // characters behind 'end' are the same again after three bytes.
+    for (size_t i = 1; i < UTF8_MAX_BYTES && start > 0; ++i) {
+        start = utf8_prev(data, start);
+    }
+    end = bytes - end > UTF8_MAX_BYTES ? end + UTF8_MAX_BYTES : bytes;
+    return utf8_length(data + start, end - start);
+}
+
+static bool buffer_index_reserve(Buffer *buf, size_t size) {
+    if (size <= buf->line_index_cap)
+        return true;
+    size_t cap = buf->line_index_cap == 0 ? 64 : buf->line_index_cap * 2;
+    while (cap < size) {
+        cap *= 2;
+    }
+    Line **tmp = realloc(buf->line_index, cap * sizeof(Line *));
+    if (tmp == NULL)
+        return false;
+    buf->line_index = tmp;
+    buf->line_index_cap = cap;
+    return true;
+}
+
+static bool buffer_index_insert(Buffer *buf, size_t index, Line *lin) {
+    if (!buffer_index_reserve(buf, buf->size + 1))
+        return false;
+    memmove(&buf->line_index[index + 1], &buf->line_index[index],
+            (buf->size - index) * sizeof(Line *));
+    buf->line_index[index] = lin;
+    buf->size++;
+    return true;
+}
+
+static void buffer_index_remove(Buffer *buf, size_t index) {
+    memmove(&buf->line_index[index], &buf->line_index[index + 1],
+            (buf->size - index - 1) * sizeof(Line *));
+    buf->size--;
+}
+
+static bool buffer_push_line(Buffer *buf, Line *lin) {
+    if (!buffer_index_insert(buf, buf->size, lin))
+        return false;
+
+    if (buf->lines == NULL) {
+        // The first line of a buffer, both first and last line are set to
+        // this line
+        buf->first_line = lin;
+        buf->last_line = lin;
+    } else {
+        // Appending to the end
+        //      last -> new
+        //      last <-> new
+        // Updating the last line
+        //      last = new
+        buf->last_line->next = lin;
+        lin->prev = buf->last_line;
+        buf->last_line = lin;
+    }
+    buf->lines = lin;
+    return true;
+}
+
+static bool buffer_push_bytes(Buffer *buf, const char *bytes, size_t len) {
+    Line *lin = line_new_from_bytes(bytes, len);
+    if (lin == NULL)
+        return false;
+    if (!buffer_push_line(buf, lin)) {
+        line_free(lin);
+        return false;
+    }
+    return true;
+}
+
+static bool buffer_follow_line(Buffer *buf, const char *bytes, size_t len) {
+    Line *lin = buf->last_line;
+    size_t partial = buf->read_partial;
+    buf->read_partial = 0;
+    if (partial == 0 || lin == NULL || lin->bytes != partial || len < partial ||
+        memcmp(lin->data, bytes, partial) != 0)
+        return buffer_push_bytes(buf, bytes, len);
+
+    if (!line_reserve(lin, len))
+        return false;
+    memcpy(lin->data, bytes, len);
+    lin->bytes = len;
+    lin->size = utf8_length(bytes, len);
+    lin->wrap_width = 0;
+    return true;
+}
 
 static bool buffer_init_empty(Buffer *buf, char *path) {
     Line *lin = calloc(1, sizeof(Line));
-    if (lin == NULL) {
+    if (lin == NULL || !buffer_push_line(buf, lin)) {
+        free(lin);
         printf("Failed to allocate space for buffer.\n");
         return false;
     }
-    buf->first_line = lin;
-    buf->last_line = lin;
-    buf->lines = lin;
     buf->file_path = path;
-    buf->size++;
     return true;
 }
 
@@ -34,62 +204,85 @@ bool buffer_read_from_file(Buffer *buf, char *path) {
     }
     buf->file_path = path;
 
-    wchar_t str[512];
-    for (buf->size = 0; fgetws(str, BUFFER_MAX_LINE_SIZE, buf->fp) != NULL;
-         ++buf->size) {
-        Line *lin = calloc(1, sizeof(Line));
-        if (lin == NULL) {
-            printf("Failed to allocate space for buffer.\n");
-            return false;
+    // The file is read at once and stays in memory as it is, lines point
+    // into it until they are edited. No conversion is needed for that, the
+    // file already is UTF-8. Files that are too large for that are mapped,
+    // the lines point into the mapping instead.
+    struct stat st;
+    size_t cap = 4096;
+    size_t max_mem = buf->state != NULL ? buf->state->max_mem : 0;
+    bool mapped = false;
+    if (fstat(fileno(buf->fp), &st) == 0 && st.st_size > 0) {
+        // One byte more than needed, so that EOF is hit without growing
+        cap = st.st_size + 1;
+        mapped = max_mem > 0 && (size_t)st.st_size > max_mem;
+    }
+    // Reading it instead would need all of the memory the limit is about
+    if (mapped && !buffer_map_file(buf, st.st_size)) {
+        printf("Failed to map file: %s\n", path);
+        return false;
+    }
+    size_t len = mapped ? buf->file_size : 0;
+    if (!mapped) {
+        buf->file_data = malloc(cap);
+    }
+    while (!mapped && buf->file_data != NULL) {
+        len += fread(buf->file_data + len, 1, cap - len, buf->fp);
+        if (len < cap)
+            break;
+        cap *= 2;
+        char *tmp = realloc(buf->file_data, cap);
+        if (tmp == NULL) {
+            free(buf->file_data);
         }
+        buf->file_data = tmp;
+    }
+    if (buf->file_data == NULL) {
+        printf("Failed to allocate space for buffer.\n");
+        return false;
+    }
 
-        size_t len = wcsnlen(str, BUFFER_MAX_LINE_SIZE);
-        Character *itr = lin->chars;
-        // len-1 in order to strip off that \n at the end
-        // we can for sure say that there is always a \n because
-        // fgetws only reads in lines
-        for (lin->size = 0; lin->size < len - 1; ++lin->size) {
-            Character *tmp = calloc(1, sizeof(Character));
-            if (tmp == NULL) {
-                printf("Failed to allocate space for buffer.\n");
-                return false;
-            }
-            tmp->value = str[lin->size];
-
-            if (lin->size == 0) {
-                // The first character of a line, both first and last char are
-                // set to this char
-                lin->first_char = tmp;
-                lin->last_char = tmp;
-            } else {
-                // Appending to the end
-                //      last -> new
-                //      last <-> new
-                // Updating the last char
-                //      last = new
-                lin->last_char->next = tmp;
-                tmp->prev = lin->last_char;
-                lin->last_char = tmp;
-            }
-            itr = tmp;
+    buf->size = 0;
+    char *start = buf->file_data;
+    char *end = buf->file_data + len;
+    size_t released = 0;
+    while (start < end) {
+        // Every line is only looked at once, the blocks behind us are
+        // released right away instead of mapping the whole file
+        size_t offset = start - buf->file_data;
+        if (mapped && offset - released >= BUFFER_BLOCK_SIZE) {
+            size_t block = offset / BUFFER_BLOCK_SIZE;
+            buffer_blocks_release(buf, released / BUFFER_BLOCK_SIZE,
+                                  block - released / BUFFER_BLOCK_SIZE);
+            released = block * BUFFER_BLOCK_SIZE;
         }
+        // The last line of a file does not need to end with a \n
+        char *nl = memchr(start, '\n', end - start);
+        size_t bytes = (nl != NULL ? nl : end) - start;
 
-        if (buf->lines == NULL) {
-            // The first line of a buffer, both first and last line are set to
-            // this line
-            buf->first_line = lin;
-            buf->last_line = lin;
-        } else {
-            // Appending to the end
-            //      last -> new
-            //      last <-> new
-            // Updating the last char
-            //      last = new
-            buf->last_line->next = lin;
-            lin->prev = buf->last_line;
-            buf->last_line = lin;
+        Line *lin = calloc(1, sizeof(Line));
+        if (lin == NULL || !buffer_push_line(buf, lin)) {
+            free(lin);
+            printf("Failed to allocate space for buffer.\n");
+            return false;
         }
-        buf->lines = lin;
+        lin->data = start;
+        lin->bytes = bytes;
+        lin->size = utf8_length(start, bytes);
+        start += bytes + 1;
+    }
+    // Following continues at the start of an unterminated last line, a
+    // record that is still being written is completed instead of split
+    buf->read_offset = len;
+    buf->read_partial = 0;
+    if (len > 0 && buf->file_data[len - 1] != '\n') {
+        buf->read_partial = buf->last_line->bytes;
+        buf->read_offset = len - buf->read_partial;
+    }
+    if (mapped) {
+        madvise(buf->file_data, buf->file_size, MADV_NORMAL);
+        buffer_map_check(buf);
+        buffer_trim(buf);
     }
 
     if (buf->size == 0) {
@@ -102,266 +295,767 @@ void buffer_free(Buffer *buf) {
     if (buf == NULL)
         return;
 
-    Line *line_itr = buf->first_line;
-    while (line_itr != NULL) {
-        Line *next_line_itr = line_itr->next;
-        Character *char_itr = line_itr->first_char;
-        while (char_itr != NULL) {
-            Character *next_char_itr = char_itr->next;
-            free(char_itr);
-            char_itr = next_char_itr;
-        }
-        free(line_itr);
-        line_itr = next_line_itr;
-    }
-}
-
-bool buffer_save(Buffer *buf, char *path) {
-    if (buf == NULL)
-        return false;
-    if (path == NULL)
-        return false;
-
+    // The save still points into the lines
+    buffer_save_finish(buf, true);
+    buffer_follow_stop(buf);
+    buffer_drop_lines(buf);
+    free(buf->line_index);
+    free(buf->cursors);
     if (buf->fp != NULL) {
         fclose(buf->fp);
     }
-    buf->fp = fopen(path, "w+");
-    if (buf->fp == NULL) {
-        return false;
-    }
+}
 
+static void buffer_drop_lines(Buffer *buf) {
     Line *line_itr = buf->first_line;
     while (line_itr != NULL) {
-        Character *char_itr = line_itr->first_char;
-        while (char_itr != NULL) {
-            fprintf(buf->fp, "%C", char_itr->value);
-            char_itr = char_itr->next;
-        }
-        fprintf(buf->fp, "\n");
-        line_itr = line_itr->next;
+        Line *next_line_itr = line_itr->next;
+        line_free(line_itr);
+        line_itr = next_line_itr;
     }
-    fclose(buf->fp);
-    return true;
+    buf->first_line = NULL;
+    buf->last_line = NULL;
+    buf->lines = NULL;
+    buf->size = 0;
+    if (buf->blocks != NULL) {
+        munmap(buf->file_data, buf->file_size);
+        buffer_map_unregister(buf->map_slot);
+        close(buf->map_fd);
+        free(buf->blocks);
+        buf->blocks = NULL;
+        buf->block_count = 0;
+        buf->block_used = 0;
+        buf->map_lost = false;
+    } else {
+        free(buf->file_data);
+    }
+    buf->file_data = NULL;
+    buf->file_size = 0;
 }
 
-void buffer_append_char_at_cursor(Buffer *buf, wint_t c) {
-    if (buf == NULL)
-        return;
-    if (buf->cursor_y >= buf->size || buf->cursor_x > BUFFER_MAX_LINE_SIZE)
-        return;
-    Line *lin = buffer_find_line(buf, buf->cursor_y);
-    if (lin == NULL || lin->size >= BUFFER_MAX_LINE_SIZE)
-        return;
-
-    Character *tmp = calloc(1, sizeof(Character));
-    if (tmp == NULL)
-        return;
-    tmp->value = c;
+// Every mapped file, looked up by the SIGBUS handler
+static BufferMapping buffer_mappings[BUFFER_MAPPINGS_MAX];
+static pthread_once_t buffer_mappings_once = PTHREAD_ONCE_INIT;
+static struct sigaction buffer_mappings_previous;
+static size_t buffer_page_size;
 
-    Character *ch = line_find_char(buf, lin, buf->cursor_x);
-    // the line is empty
-    if (ch == NULL) {
-        lin->first_char = tmp;
-        lin->last_char = tmp;
-        lin->size++;
+static void buffer_map_fault(int sig, siginfo_t *info, void *context) {
+    (void)context;
+    uintptr_t addr = (uintptr_t)info->si_addr;
+    for (size_t i = 0; i < BUFFER_MAPPINGS_MAX; ++i) {
+        BufferMapping *mapping = &buffer_mappings[i];
+        uintptr_t start = __atomic_load_n(&mapping->start, __ATOMIC_ACQUIRE);
+        if (start == 0 || addr < start ||
+            addr - start >= __atomic_load_n(&mapping->len, __ATOMIC_RELAXED))
+            continue;
+        // mmap is a plain system call, the faulting access is repeated once
+        // the handler returns and reads zeros
+        void *page = (void *)(addr & ~(uintptr_t)(buffer_page_size - 1));
+        if (mmap(page, buffer_page_size, PROT_READ,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+            break;
+        __atomic_store_n(&mapping->lost, true, __ATOMIC_RELAXED);
         return;
     }
+    // Not ours, it is raised again as if there was no handler
+    sigaction(SIGBUS, &buffer_mappings_previous, NULL);
+    raise(sig);
+}
 
-    // if cursor is at the end of the line
-    if (buf->cursor_x >= lin->size - 1) {
-        // Appending to the end
-        //      last -> new
-        //      last <-> new
-        // Updating the last char
-        //      last = new
-        lin->last_char->next = tmp;
-        tmp->prev = lin->last_char;
-        lin->last_char = tmp;
-    } else {
-        // Example:
-        // 'a' is being placed between 'c' and 'd'
-        //      b <-> c <-> d
+static void buffer_map_install(void) {
+    buffer_page_size = sysconf(_SC_PAGESIZE);
+    struct sigaction action = {0};
+    action.sa_sigaction = buffer_map_fault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, &buffer_mappings_previous);
+}
 
-        //      b <-> c  a -> d
-        tmp->next = ch->next;
+static size_t buffer_map_register(char *data, size_t size) {
+    pthread_once(&buffer_mappings_once, buffer_map_install);
+    for (size_t i = 0; i < BUFFER_MAPPINGS_MAX; ++i) {
+        BufferMapping *mapping = &buffer_mappings[i];
+        bool unused = false;
+        if (!__atomic_compare_exchange_n(&mapping->used, &unused, true, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            continue;
+        __atomic_store_n(&mapping->lost, false, __ATOMIC_RELAXED);
+        __atomic_store_n(&mapping->len, size, __ATOMIC_RELAXED);
+        __atomic_store_n(&mapping->start, (uintptr_t)data, __ATOMIC_RELEASE);
+        return i;
+    }
+    return BUFFER_MAPPINGS_MAX;
+}
 
-        //      b <-> c <- a -> d
-        tmp->prev = ch;
+static void buffer_map_unregister(size_t slot) {
+    BufferMapping *mapping = &buffer_mappings[slot];
+    __atomic_store_n(&mapping->start, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&mapping->used, false, __ATOMIC_RELEASE);
+}
 
-        //      b <-> c <- a <-> d
-        ch->next->prev = tmp;
+static bool buffer_map_check(Buffer *buf) {
+    if (buf->blocks == NULL)
+        return false;
+    if (buf->map_lost)
+        return true;
 
-        //      b <-> c <-> a <-> d
-        ch->next = tmp;
+    bool lost = __atomic_load_n(&buffer_mappings[buf->map_slot].lost,
+                                __ATOMIC_RELAXED);
+    struct stat st;
+    if (fstat(buf->map_fd, &st) == 0 && (size_t)st.st_size < buf->file_size) {
+        // The pages behind the new end would raise SIGBUS, they are
+        // replaced with zeros before anyone gets there. The partial page at
+        // the end reads as zeros behind the end on its own.
+        size_t end = ((size_t)st.st_size + buffer_page_size - 1) &
+                     ~(buffer_page_size - 1);
+        if (end < buf->file_size) {
+            mmap(buf->file_data + end, buf->file_size - end, PROT_READ,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        }
+        lost = true;
+        // A save that is running must not replace the file with the zeros
+        __atomic_store_n(&buffer_mappings[buf->map_slot].lost, true,
+                         __ATOMIC_RELAXED);
     }
-    lin->size++;
-    buf->render_cursor_x += wcwidth(c);
-    buf->cursor_x++;
+    buf->map_lost = lost;
+    return lost;
 }
 
-Line *buffer_find_line(Buffer *buf, size_t index) {
-    if (buf == NULL)
-        return NULL;
-    Line *itr = buf->first_line;
-    for (size_t i = 0; i < buf->size && itr != NULL; ++i, itr = itr->next) {
-        if (i == index) {
-            return itr;
-        }
+static bool buffer_map_file(Buffer *buf, size_t size) {
+    // 'fp' is closed by a save, the file is checked for truncation through
+    // a descriptor of its own
+    int fd = dup(fileno(buf->fp));
+    if (fd < 0)
+        return false;
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
     }
-    return NULL;
+    size_t count = (size + BUFFER_BLOCK_SIZE - 1) / BUFFER_BLOCK_SIZE;
+    BufferBlock *blocks = calloc(count, sizeof(BufferBlock));
+    size_t slot = blocks != NULL ? buffer_map_register(data, size)
+                                 : BUFFER_MAPPINGS_MAX;
+    if (slot == BUFFER_MAPPINGS_MAX) {
+        free(blocks);
+        munmap(data, size);
+        close(fd);
+        return false;
+    }
+    // The file is read from start to end once while the lines are split
+    madvise(data, size, MADV_SEQUENTIAL);
+    buf->file_data = data;
+    buf->file_size = size;
+    buf->blocks = blocks;
+    buf->block_count = count;
+    buf->block_first = BUFFER_BLOCK_NONE;
+    buf->block_last = BUFFER_BLOCK_NONE;
+    buf->block_used = 0;
+    buf->map_fd = fd;
+    buf->map_slot = slot;
+    buf->map_lost = false;
+    return true;
 }
 
-Character *line_find_char(Buffer *buf, Line *lin, size_t index) {
-    if (buf == NULL)
-        return NULL;
-    if (lin == NULL)
-        return NULL;
-    Character *itr = lin->first_char;
-    for (size_t i = 0; i < lin->size && itr != NULL; ++i, itr = itr->next) {
-        if (i == index) {
-            return itr;
-        }
+static void buffer_blocks_release(Buffer *buf, size_t first, size_t count) {
+    size_t offset = first * BUFFER_BLOCK_SIZE;
+    size_t len = count * BUFFER_BLOCK_SIZE;
+    if (len > buf->file_size - offset) {
+        len = buf->file_size - offset;
     }
-    return NULL;
+    // The mapping is never written to, the kernel simply drops the pages
+    // and reads them from the file again on the next access
+    madvise(buf->file_data + offset, len, MADV_DONTNEED);
 }
 
-// TODO: Fix wide character handling, since that is still kind of buggy
+static void buffer_block_touch(Buffer *buf, size_t index) {
+    BufferBlock *blocks = buf->blocks;
+    BufferBlock *block = &blocks[index];
+    if (buf->block_first == index)
+        return;
 
-void buffer_move_cursor_down(Buffer *buf) {
-    if (buf != NULL && buf->state != NULL && buf->cursor_y < buf->size - 1) {
-        buf->cursor_y++;
-        buf->render_cursor_x = 0;
-        buf->cursor_x = 0;
-        if (buf->cursor_y > buf->state->max_y &&
-            buf->cursor_y >= buf->cursor_max) {
-            buf->cursor_max++;
+    if (block->used) {
+        blocks[block->prev].next = block->next;
+        if (block->next != BUFFER_BLOCK_NONE) {
+            blocks[block->next].prev = block->prev;
+        } else {
+            buf->block_last = block->prev;
+        }
+    } else {
+        size_t max_mem = buf->state != NULL ? buf->state->max_mem : 0;
+        size_t cap = max_mem / BUFFER_BLOCK_SIZE > 0
+                         ? max_mem / BUFFER_BLOCK_SIZE
+                         : 1;
+        while (max_mem > 0 && buf->block_used >= cap) {
+            size_t last = buf->block_last;
+            buf->block_last = blocks[last].prev;
+            if (buf->block_last != BUFFER_BLOCK_NONE) {
+                blocks[buf->block_last].next = BUFFER_BLOCK_NONE;
+            } else {
+                buf->block_first = BUFFER_BLOCK_NONE;
+            }
+            blocks[last].used = false;
+            buf->block_used--;
+            buffer_blocks_release(buf, last, 1);
         }
+        block->used = true;
+        buf->block_used++;
+        // The block is loaded from the file again, which may have been
+        // truncated meanwhile
+        buffer_map_check(buf);
     }
-}
 
-void buffer_move_cursor_up(Buffer *buf) {
-    if (buf != NULL && buf->cursor_y > 0) {
-        buf->cursor_y--;
-        buf->render_cursor_x = 0;
-        buf->cursor_x = 0;
-        if (buf->cursor_y <= buf->scroll_y) {
-            buf->cursor_max--;
-        }
+    block->prev = BUFFER_BLOCK_NONE;
+    block->next = buf->block_first;
+    if (buf->block_first != BUFFER_BLOCK_NONE) {
+        blocks[buf->block_first].prev = index;
+    } else {
+        buf->block_last = index;
     }
+    buf->block_first = index;
 }
 
-void buffer_move_cursor_right(Buffer *buf) {
-    if (buf == NULL)
+void buffer_touch_line(Buffer *buf, Line *lin) {
+    if (buf == NULL || lin == NULL || buf->blocks == NULL ||
+        lin->capacity > 0 || lin->bytes == 0)
         return;
-    Line *lin = buffer_find_line(buf, buf->cursor_y);
-    if (lin != NULL && lin->size != 0 && buf->cursor_x < lin->size - 1 &&
-        buf->render_cursor_x < lin->size - 1) {
-        if (buffer_move_render_cursor(buf, 1)) {
-            buf->cursor_x++;
-        }
+    uintptr_t data = (uintptr_t)lin->data;
+    uintptr_t file_data = (uintptr_t)buf->file_data;
+    if (data < file_data || data >= file_data + buf->file_size)
+        return;
+
+    size_t offset = data - file_data;
+    size_t last = (offset + lin->bytes - 1) / BUFFER_BLOCK_SIZE;
+    if (last != offset / BUFFER_BLOCK_SIZE) {
+        buffer_block_touch(buf, last);
     }
+    buffer_block_touch(buf, offset / BUFFER_BLOCK_SIZE);
 }
 
-void buffer_move_cursor_left(Buffer *buf) {
-    if (buf != NULL && buf->cursor_x > 0 && buf->render_cursor_x > 0) {
-        if (buffer_move_render_cursor(buf, -1)) {
-            buf->cursor_x--;
+void buffer_trim(Buffer *buf) {
+    if (buf == NULL || buf->blocks == NULL)
+        return;
+
+    // Neighbouring blocks are released at once
+    size_t start = 0;
+    for (size_t i = 0; i <= buf->block_count; ++i) {
+        if (i < buf->block_count && !buf->blocks[i].used)
+            continue;
+        if (i > start) {
+            buffer_blocks_release(buf, start, i - start);
         }
+        start = i + 1;
     }
 }
 
-bool buffer_delete_char_at_cursor_xy(Buffer *buf, size_t cursor_x,
-                                     size_t cursor_y) {
-    if (buf == NULL)
-        return false;
+static void buffer_save_push(BufferSave *save, Line *lin) {
+    bool borrowed = lin->capacity == 0;
+    SaveSegment *last = save->segment_count > 0
+                            ? &save->segments[save->segment_count - 1]
+                            : NULL;
+    save->total += lin->bytes + 1;
 
-    Line *lin = buffer_find_line(buf, cursor_y);
-    if (lin == NULL || lin->size <= 0)
-        return false;
+    // The next line of the file, the \n in front of it is written as well
+    if (borrowed && lin->data != NULL && last != NULL && !last->shared &&
+        last->data != NULL && last->data + last->bytes + 1 == lin->data) {
+        last->bytes += 1 + lin->bytes;
+        return;
+    }
 
-    Character *ch = line_find_char(buf, lin, cursor_x);
-    if (ch == NULL)
-        return false;
-    if (ch == lin->first_char) {
-        // Example:
-        //      |a| <-> b <-> c
-        //      b <-> c
-        lin->first_char = ch->next;
-    } else if (ch == lin->last_char) {
-        lin->last_char = ch->prev;
-        buf->render_cursor_x -= wcwidth(ch->value);
-        buf->cursor_x--;
-    } else {
-        // Example:
-        //      a <-> |b| <-> c
-        //
-        // 1.   ______________
-        //     |             |
-        //     a <-> |b| ->  c
-        // 2.
-        //     a <-> c
-        ch->next->prev = ch->prev;
-        ch->prev->next = ch->next;
-    }
-    free(ch);
-    lin->size--;
-    return true;
+    SaveSegment *segment = &save->segments[save->segment_count++];
+    segment->data = lin->data;
+    segment->bytes = lin->bytes;
+    segment->shared = !borrowed;
+    if (segment->shared) {
+        // The buffer is not changed meanwhile, see buffer_save_wait_walk
+        __atomic_add_fetch((size_t *)lin->data - 1, 1, __ATOMIC_RELAXED);
+    }
 }
 
-bool buffer_delete_char_at_cursor_x(Buffer *buf, size_t cursor_x) {
-    if (buf != NULL) {
-        return buffer_delete_char_at_cursor_xy(buf, cursor_x, buf->cursor_y);
+static bool buffer_save_walk(BufferSave *save) {
+    // Every line needs a segment at most, growing the array would take
+    // longer than the walk itself
+    save->segments = malloc(save->lines * sizeof(SaveSegment));
+    bool ok = save->segments != NULL;
+    for (Line *itr = save->first; itr != NULL && ok; itr = itr->next) {
+        buffer_save_push(save, itr);
     }
-    return false;
+    pthread_mutex_lock(&save->lock);
+    __atomic_store_n(&save->walked, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&save->walked_cond);
+    pthread_mutex_unlock(&save->lock);
+    return ok;
 }
 
-bool buffer_delete_char_at_cursor(Buffer *buf) {
-    if (buf != NULL) {
-        return buffer_delete_char_at_cursor_xy(buf, buf->cursor_x,
-                                               buf->cursor_y);
+static void buffer_save_wait_walk(Buffer *buf) {
+    BufferSave *save = buf->save;
+    if (save == NULL || __atomic_load_n(&save->walked, __ATOMIC_ACQUIRE))
+        return;
+    pthread_mutex_lock(&save->lock);
+    while (!__atomic_load_n(&save->walked, __ATOMIC_ACQUIRE)) {
+        pthread_cond_wait(&save->walked_cond, &save->lock);
     }
-    return false;
+    pthread_mutex_unlock(&save->lock);
 }
 
-bool buffer_delete_line(Buffer *buf, Line *lin) {
-    if (buf == NULL || lin == NULL || lin->next == NULL || lin->prev == NULL)
+static bool buffer_save_open(Buffer *buf, BufferSave *save, char *path) {
+    if (buf->blocks == NULL) {
+        // Truncating a large file takes a while, the writer does so at the
+        // end
+        int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+        if (fd < 0)
+            return false;
+        save->fp = fdopen(fd, "w");
+        if (save->fp == NULL) {
+            close(fd);
+            return false;
+        }
+        return true;
+    }
+
+    // A symlink stays in place, the file it points to is replaced
+    save->target = realpath(path, NULL);
+    if (save->target == NULL)
+        return false;
+    size_t len = strlen(save->target);
+    save->tmp_path = malloc(len + sizeof(".XXXXXX"));
+    if (save->tmp_path == NULL)
         return false;
+    memcpy(save->tmp_path, save->target, len);
+    memcpy(save->tmp_path + len, ".XXXXXX", sizeof(".XXXXXX"));
 
-    if (lin == buf->first_line) {
-        buf->first_line = lin->next;
-    } else {
-        lin->next->prev = lin->prev;
-        lin->prev->next = lin->next;
+    int fd = mkostemp(save->tmp_path, O_CLOEXEC);
+    if (fd < 0) {
+        free(save->tmp_path);
+        save->tmp_path = NULL;
+        return false;
     }
-
-    if (lin->size > 0) {
-        Character *itr = lin->first_char;
-        while (itr != NULL) {
-            Character *next_itr = itr->next;
-            free(itr);
-            itr = next_itr;
-        }
+    struct stat st;
+    if (stat(save->target, &st) == 0) {
+        fchmod(fd, st.st_mode & 07777);
     }
-    free(lin);
-    buf->size--;
-
-    if (buf->cursor_y <= buf->scroll_y) {
-        buf->cursor_max--;
+    save->fp = fdopen(fd, "w");
+    if (save->fp == NULL) {
+        close(fd);
+        unlink(save->tmp_path);
+        free(save->tmp_path);
+        save->tmp_path = NULL;
+        return false;
     }
+    save->map = buf->file_data;
+    save->page_size = buffer_page_size;
+    save->map_fd = buf->map_fd;
+    save->map_size = buf->file_size;
+    save->map_slot = buf->map_slot;
     return true;
 }
 
-bool buffer_insert_line_at_cursor_y(Buffer *buf, size_t cursor_y) {
-    if (buf == NULL)
-        return false;
-
-    Line *curr_lin = buffer_find_line(buf, cursor_y);
-    if (curr_lin == NULL)
+static bool buffer_save_prepare(Buffer *buf, char *path) {
+    // Lines that read as zeros would replace the content of the file
+    if (buf->save != NULL || buffer_map_check(buf))
         return false;
-
-    Line *lin = calloc(1, sizeof(Line));
-    if (lin == NULL)
+    BufferSave *save = calloc(1, sizeof(BufferSave));
+    if (save == NULL)
         return false;
+    pthread_mutex_init(&save->lock, NULL);
+    pthread_cond_init(&save->walked_cond, NULL);
+    save->first = buf->first_line;
+    save->lines = buf->size;
+
+    if (buf->fp != NULL) {
+        fclose(buf->fp);
+        buf->fp = NULL;
+    }
+    if (!buffer_save_open(buf, save, path)) {
+        buffer_save_free(save);
+        return false;
+    }
+    buf->save = save;
+    return true;
+}
+
+static bool buffer_save_write(BufferSave *save, const char *data, size_t len,
+                              bool mapped) {
+    bool ok = true;
+    // A segment may be the whole file, it is written in chunks
+    for (size_t offset = 0; offset < len && ok;) {
+        size_t part = len - offset;
+        if (part > BUFFER_SAVE_CHUNK_SIZE) {
+            part = BUFFER_SAVE_CHUNK_SIZE;
+        }
+        ok = fwrite(data + offset, 1, part, save->fp) == part;
+        if (mapped) {
+            // Whatever is still in use is loaded again, see
+            // buffer_blocks_release
+            uintptr_t start = (uintptr_t)(data + offset);
+            uintptr_t page = start & ~(uintptr_t)(save->page_size - 1);
+            madvise((void *)page, start + part - page, MADV_DONTNEED);
+        }
+        offset += part;
+        __atomic_add_fetch(&save->written, part, __ATOMIC_RELAXED);
+    }
+    return ok;
+}
+
+static void *buffer_save_worker(void *arg) {
+    BufferSave *save = arg;
+    PROFILE_BEGIN(PROFILE_SAVE_WORKER);
+    // Short lines are collected in 'chunk' and written together
+    char *chunk = malloc(BUFFER_SAVE_CHUNK_SIZE);
+    size_t used = 0;
+    bool ok = buffer_save_walk(save) && chunk != NULL;
+    // Every shared line is released, even after writing failed
+    for (size_t i = 0; i < save->segment_count; ++i) {
+        const SaveSegment *segment = &save->segments[i];
+        bool fits = segment->bytes < BUFFER_SAVE_CHUNK_SIZE - used;
+        if (ok && !fits && used > 0) {
+            ok = buffer_save_write(save, chunk, used, false);
+            used = 0;
+            fits = segment->bytes < BUFFER_SAVE_CHUNK_SIZE;
+        }
+        if (ok && fits) {
+            if (segment->bytes > 0) {
+                memcpy(chunk + used, segment->data, segment->bytes);
+                used += segment->bytes;
+            }
+            chunk[used++] = '\n';
+        } else if (ok) {
+            ok = buffer_save_write(save, segment->data, segment->bytes,
+                                   save->map != NULL && !segment->shared) &&
+                 buffer_save_write(save, "\n", 1, false);
+        }
+        // The line can be edited in place again
+        if (segment->shared) {
+            line_release((char *)segment->data);
+        }
+    }
+    if (ok && used > 0) {
+        ok = buffer_save_write(save, chunk, used, false);
+    }
+    free(chunk);
+    // The file has been overwritten, whatever is left of the old content is
+    // cut off
+    if (ok && (fflush(save->fp) != 0 ||
+               ftruncate(fileno(save->fp), save->total) != 0)) {
+        ok = false;
+    }
+    if (fclose(save->fp) != 0) {
+        ok = false;
+    }
+    save->fp = NULL;
+    if (save->map != NULL) {
+        // Truncating the mapped file meanwhile turned lines into zeros
+        struct stat st;
+        ok = ok &&
+             !__atomic_load_n(&buffer_mappings[save->map_slot].lost,
+                              __ATOMIC_RELAXED) &&
+             fstat(save->map_fd, &st) == 0 &&
+             (size_t)st.st_size >= save->map_size;
+    }
+    if (save->target != NULL) {
+        ok = ok && rename(save->tmp_path, save->target) == 0;
+        if (!ok) {
+            unlink(save->tmp_path);
+        }
+    }
+    save->ok = ok;
+    PROFILE_END(PROFILE_SAVE_WORKER);
+    __atomic_store_n(&save->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void buffer_save_free(BufferSave *save) {
+    if (save == NULL)
+        return;
+    if (save->fp != NULL) {
+        fclose(save->fp);
+        if (save->tmp_path != NULL) {
+            unlink(save->tmp_path);
+        }
+    }
+    free(save->target);
+    free(save->tmp_path);
+    pthread_mutex_destroy(&save->lock);
+    pthread_cond_destroy(&save->walked_cond);
+    free(save->segments);
+    free(save);
+}
+
+bool buffer_save_start(Buffer *buf, char *path) {
+    if (buf == NULL || path == NULL || !buffer_save_prepare(buf, path))
+        return false;
+    BufferSave *save = buf->save;
+    save->threaded = pthread_create(&save->thread, NULL, buffer_save_worker,
+                                    save) == 0;
+    if (!save->threaded) {
+        buffer_save_worker(save);
+    }
+    return true;
+}
+
+size_t buffer_save_progress(Buffer *buf) {
+    // 'total' is only known once the snapshot is taken
+    if (buf == NULL || buf->save == NULL ||
+        !__atomic_load_n(&buf->save->walked, __ATOMIC_ACQUIRE) ||
+        buf->save->total == 0)
+        return 0;
+    size_t written = __atomic_load_n(&buf->save->written, __ATOMIC_RELAXED);
+    return written * 100 / buf->save->total;
+}
+
+enum BufferSaveStatus buffer_save_finish(Buffer *buf, bool wait) {
+    if (buf == NULL || buf->save == NULL)
+        return BUFFER_SAVE_NONE;
+
+    BufferSave *save = buf->save;
+    if (save->threaded) {
+        if (!wait && !__atomic_load_n(&save->done, __ATOMIC_ACQUIRE))
+            return BUFFER_SAVE_RUNNING;
+        pthread_join(save->thread, NULL);
+    }
+    bool ok = save->ok;
+    if (ok) {
+        // The buffer stays open, a followed file must not read its own
+        // content back as new lines
+        buf->read_offset = save->total;
+        buf->read_partial = 0;
+#ifdef HAVE_SYS_INOTIFY_H
+        // The watch still belongs to the replaced file
+        if (save->target != NULL && buf->follow) {
+            inotify_add_watch(buf->watch_fd, save->target, IN_MODIFY);
+        }
+#endif
+    }
+    buffer_save_free(save);
+    buf->save = NULL;
+    // Sets 'map_lost' if the save failed because of it
+    if (!ok) {
+        buffer_map_check(buf);
+    }
+    // The writer loaded every block of a mapped file
+    buffer_trim(buf);
+    return ok ? BUFFER_SAVE_DONE : BUFFER_SAVE_FAILED;
+}
+
+bool buffer_save(Buffer *buf, char *path) {
+    if (buf == NULL)
+        return false;
+    if (path == NULL)
+        return false;
+
+    if (!buffer_save_prepare(buf, path))
+        return false;
+    buffer_save_worker(buf->save);
+    return buffer_save_finish(buf, true) == BUFFER_SAVE_DONE;
+}
+
+void buffer_append_char_at_cursor(Buffer *buf, wint_t c) {
+    if (buf == NULL)
+        return;
+    buffer_save_wait_walk(buf);
+    Line *lin = buffer_find_line(buf, buf->cursor_y);
+    if (lin == NULL)
+        return;
+
+    char str[UTF8_MAX_BYTES];
+    size_t len = utf8_encode(c, str);
+    if (!line_reserve(lin, lin->bytes + len))
+        return;
+
+    // The new character is placed behind the one at the cursor, an empty
+    // line just gets its first character
+    size_t offset = 0;
+    size_t x = buf->cursor_x < lin->size ? buf->cursor_x : lin->size - 1;
+    wint_t prev = WEOF;
+    if (lin->size > 0) {
+        offset = line_offset(lin, x);
+        offset += utf8_decode(lin->data + offset, lin->bytes - offset, &prev);
+    }
+    memmove(lin->data + offset + len, lin->data + offset,
+            lin->bytes - offset);
+    memcpy(lin->data + offset, str, len);
+    lin->bytes += len;
+    lin->size++;
+    lin->wrap_width = 0;
+
+    if (prev != WEOF) {
+        if (x == buf->cursor_x) {
+            buf->render_cursor_x += character_width(prev);
+            buf->cursor_x++;
+        } else {
+            buffer_set_cursor_x(buf, lin, x + 1);
+        }
+    }
+}
+
+Line *buffer_find_line(Buffer *buf, size_t index) {
+    if (buf == NULL || index >= buf->size)
+        return NULL;
+    buffer_touch_line(buf, buf->line_index[index]);
+    return buf->line_index[index];
+}
+
+size_t line_offset(Line *lin, size_t index) {
+    if (lin == NULL)
+        return 0;
+    if (index >= lin->size)
+        return lin->bytes;
+    if (lin->bytes == lin->size)
+        return index;
+
+    size_t offset = 0;
+    wint_t c;
+    for (size_t i = 0; i < index; ++i) {
+        offset += utf8_decode(lin->data + offset, lin->bytes - offset, &c);
+    }
+    return offset;
+}
+
+wint_t line_char_at(Line *lin, size_t index) {
+    if (lin == NULL || index >= lin->size)
+        return WEOF;
+    size_t offset = line_offset(lin, index);
+    wint_t c;
+    utf8_decode(lin->data + offset, lin->bytes - offset, &c);
+    return c;
+}
+
+// TODO: Fix wide character handling, since that is still kind of buggy
+
+void buffer_move_cursor_down(Buffer *buf) {
+    if (buf != NULL && buf->cursor_y < buf->size - 1) {
+        buf->cursor_y++;
+        buf->render_cursor_x = 0;
+        buf->cursor_x = 0;
+    }
+}
+
+void buffer_move_cursor_up(Buffer *buf) {
+    if (buf != NULL && buf->cursor_y > 0) {
+        buf->cursor_y--;
+        buf->render_cursor_x = 0;
+        buf->cursor_x = 0;
+    }
+}
+
+void buffer_move_cursor_right(Buffer *buf) {
+    if (buf == NULL)
+        return;
+    Line *lin = buffer_find_line(buf, buf->cursor_y);
+    if (lin != NULL && lin->size != 0 && buf->cursor_x < lin->size - 1 &&
+        buf->render_cursor_x < lin->size - 1) {
+        if (buffer_move_render_cursor(buf, 1)) {
+            buf->cursor_x++;
+        }
+    }
+}
+
+void buffer_move_cursor_left(Buffer *buf) {
+    if (buf != NULL && buf->cursor_x > 0 && buf->render_cursor_x > 0) {
+        if (buffer_move_render_cursor(buf, -1)) {
+            buf->cursor_x--;
+        }
+    }
+}
+
+bool buffer_delete_char_at_cursor_xy(Buffer *buf, size_t cursor_x,
+                                     size_t cursor_y) {
+    if (buf == NULL)
+        return false;
+    buffer_save_wait_walk(buf);
+
+    Line *lin = buffer_find_line(buf, cursor_y);
+    if (lin == NULL || lin->size <= 0 || cursor_x >= lin->size)
+        return false;
+    if (!line_reserve(lin, lin->bytes))
+        return false;
+
+    size_t offset = line_offset(lin, cursor_x);
+    wint_t c;
+    size_t len = utf8_decode(lin->data + offset, lin->bytes - offset, &c);
+    size_t around =
+        line_count_around(lin->data, lin->bytes, offset, offset + len);
+    memmove(lin->data + offset, lin->data + offset + len,
+            lin->bytes - offset - len);
+    lin->bytes -= len;
+
+    // Deleting the last character moves the cursor onto the new last one
+    if (cursor_x > 0 && cursor_x == lin->size - 1) {
+        buf->render_cursor_x -= character_width(c);
+        buf->cursor_x--;
+    }
+    size_t size = lin->size;
+    lin->size = size - around +
+                line_count_around(lin->data, lin->bytes, offset, offset);
+    lin->wrap_width = 0;
+    if (lin->size + 1 != size && cursor_y == buf->cursor_y) {
+        // Invalid bytes have been joined into a character, the characters
+        // in front of the cursor may have changed
+        size_t x = buf->cursor_x < lin->size ? buf->cursor_x : lin->size - 1;
+        buffer_set_cursor_x(buf, lin, lin->size > 0 ? x : 0);
+    }
+    return true;
+}
+
+bool buffer_delete_char_at_cursor_x(Buffer *buf, size_t cursor_x) {
+    if (buf != NULL) {
+        return buffer_delete_char_at_cursor_xy(buf, cursor_x, buf->cursor_y);
+    }
+    return false;
+}
+
+bool buffer_delete_char_at_cursor(Buffer *buf) {
+    if (buf != NULL) {
+        return buffer_delete_char_at_cursor_xy(buf, buf->cursor_x,
+                                               buf->cursor_y);
+    }
+    return false;
+}
+
+bool buffer_delete_line(Buffer *buf, Line *lin) {
+    if (buf == NULL || lin == NULL || lin->next == NULL || lin->prev == NULL)
+        return false;
+    buffer_save_wait_walk(buf);
+
+    // The line that is deleted is almost always the one at the cursor
+    size_t index = buf->cursor_y;
+    if (buffer_find_line(buf, index) != lin) {
+        for (index = 0; index < buf->size; ++index) {
+            if (buf->line_index[index] == lin)
+                break;
+        }
+        if (index == buf->size)
+            return false;
+    }
+
+    if (lin == buf->first_line) {
+        buf->first_line = lin->next;
+    } else {
+        lin->next->prev = lin->prev;
+        lin->prev->next = lin->next;
+    }
+
+    line_free(lin);
+    buffer_index_remove(buf, index);
+    return true;
+}
+
+bool buffer_insert_line_at_cursor_y(Buffer *buf, size_t cursor_y) {
+    if (buf == NULL)
+        return false;
+    buffer_save_wait_walk(buf);
+
+    Line *curr_lin = buffer_find_line(buf, cursor_y);
+    if (curr_lin == NULL)
+        return false;
+
+    Line *lin = calloc(1, sizeof(Line));
+    if (lin == NULL)
+        return false;
+    if (!buffer_index_insert(buf, cursor_y + 1, lin)) {
+        free(lin);
+        return false;
+    }
 
     if (curr_lin == buf->last_line) {
         buf->last_line->next = lin;
@@ -384,7 +1078,6 @@ bool buffer_insert_line_at_cursor_y(Buffer *buf, size_t cursor_y) {
         //      b <-> c <-> a <-> d
         curr_lin->next = lin;
     }
-    buf->size++;
     return true;
 }
 
@@ -395,10 +1088,6 @@ bool buffer_insert_line_at_cursor(Buffer *buf) {
             buf->cursor_y++;
             buf->render_cursor_x = 0;
             buf->cursor_x = 0;
-            if (buf->cursor_y > buf->state->max_y &&
-                buf->cursor_y >= buf->cursor_max) {
-                buf->cursor_max++;
-            }
             return true;
         }
     }
@@ -410,17 +1099,1249 @@ bool buffer_move_render_cursor_x(Buffer *buf, size_t cursor_x,
     if (buf == NULL)
         return false;
 
-    Line *lin = buffer_find_line(buf, buf->cursor_y);
-    if (lin == NULL)
-        return false;
-    Character *ch = line_find_char(buf, lin, cursor_x);
-    if (ch == NULL)
+    wint_t c = line_char_at(buffer_find_line(buf, buf->cursor_y), cursor_x);
+    if (c == WEOF)
         return false;
 
-    buf->render_cursor_x += wcwidth(ch->value) * direction_x;
+    buf->render_cursor_x += character_width(c) * direction_x;
     return true;
 }
 
 bool buffer_move_render_cursor(Buffer *buf, int direction_x) {
     return buffer_move_render_cursor_x(buf, buf->cursor_x, direction_x);
 }
+
+bool buffer_follow_start(Buffer *buf) {
+#ifdef HAVE_SYS_INOTIFY_H
+    if (buf == NULL || buf->file_path == NULL)
+        return false;
+    if (buf->follow)
+        return true;
+
+    buf->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (buf->watch_fd < 0)
+        return false;
+    if (inotify_add_watch(buf->watch_fd, buf->file_path, IN_MODIFY) < 0) {
+        close(buf->watch_fd);
+        return false;
+    }
+    buf->follow = true;
+
+    // Catch up on everything that has been written since the file was read
+    buffer_follow_update(buf);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void buffer_follow_stop(Buffer *buf) {
+    if (buf == NULL || !buf->follow)
+        return;
+    close(buf->watch_fd);
+    buf->follow = false;
+}
+
+bool buffer_follow_update(Buffer *buf) {
+    if (buf == NULL || !buf->follow)
+        return false;
+
+    // Drain the pending events, we only care that something happened
+    char events[4096];
+    while (read(buf->watch_fd, events, sizeof(events)) > 0)
+        ;
+    // The file is being written by ped itself
+    if (buf->save != NULL)
+        return false;
+
+    int fd = open(buf->file_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    off_t known = buf->read_offset + (off_t)buf->read_partial;
+    if (fstat(fd, &st) < 0 || st.st_size == known) {
+        close(fd);
+        return false;
+    }
+    bool changed = false;
+    if (st.st_size < known) {
+        // The file was truncated (e.g. by log rotation), continue following
+        // from the start of the new content just like 'tail -f' does
+        buf->read_offset = 0;
+        buf->read_partial = 0;
+        // The lines of a mapped file have been cut off with it, the buffer
+        // starts over like a file that has just been opened
+        if (buffer_map_check(buf)) {
+            buffer_drop_lines(buf);
+            if (!buffer_init_empty(buf, buf->file_path)) {
+                close(fd);
+                return false;
+            }
+            buf->cursor_y = 0;
+            buf->cursor_x = 0;
+            buf->render_cursor_x = 0;
+            buf->scroll_y = 0;
+            buf->cursor_count = 0;
+            changed = true;
+        }
+    }
+
+    bool was_at_end = buf->cursor_y + 1 >= buf->size;
+    size_t old_size = buf->size;
+
+    // 'pending' holds the bytes of a line that is not terminated yet
+    char *pending = NULL;
+    size_t pending_len = 0;
+    size_t pending_cap = 0;
+    off_t offset = buf->read_offset;
+    bool ok = true;
+    while (ok) {
+        if (pending_cap - pending_len < BUFFER_FOLLOW_CHUNK_SIZE) {
+            size_t cap = pending_len + BUFFER_FOLLOW_CHUNK_SIZE;
+            char *tmp = realloc(pending, cap);
+            if (tmp == NULL) {
+                ok = false;
+                break;
+            }
+            pending = tmp;
+            pending_cap = cap;
+        }
+
+        ssize_t n = pread(fd, pending + pending_len, BUFFER_FOLLOW_CHUNK_SIZE,
+                          offset);
+        if (n <= 0)
+            break;
+        offset += n;
+
+        // Only complete lines are consumed, 'read_offset' therefore always
+        // points to the start of a line
+        char *start = pending;
+        char *end = pending + pending_len + n;
+        char *nl;
+        while ((nl = memchr(start, '\n', end - start)) != NULL) {
+            if (!buffer_follow_line(buf, start, nl - start)) {
+                ok = false;
+                break;
+            }
+            buf->read_offset += nl - start + 1;
+            changed = true;
+            start = nl + 1;
+        }
+        pending_len = end - start;
+        memmove(pending, start, pending_len);
+    }
+    // The rest is shown already, it is replaced once it is complete
+    if (ok && pending_len > buf->read_partial) {
+        ok = buffer_follow_line(buf, pending, pending_len);
+        buf->read_partial = ok ? pending_len : 0;
+        changed = true;
+    }
+    free(pending);
+    close(fd);
+
+    if (!changed)
+        return false;
+
+    // Stick to the end of the file if the cursor was already there
+    if (was_at_end && buf->size != old_size) {
+        buf->cursor_y = buf->size - 1;
+        buf->cursor_x = 0;
+        buf->render_cursor_x = 0;
+    }
+    return true;
+}
+
+int character_width(wint_t c) {
+    int width = wcwidth(c);
+    return width < 0 ? 1 : width;
+}
+
+size_t line_wrap(Line *lin, size_t width) {
+    if (lin == NULL)
+        return 1;
+    if (width == 0)
+        width = 1;
+    if (lin->wrap_width == width)
+        return lin->wrap_count;
+
+    // First pass counts the rows, the second one stores where they start
+    size_t count = 1;
+    size_t col = 0;
+    wint_t c;
+    for (size_t offset = 0; offset < lin->bytes;) {
+        offset += utf8_decode(lin->data + offset, lin->bytes - offset, &c);
+        int w = character_width(c);
+        if (col + w > width && col > 0) {
+            count++;
+            col = 0;
+        }
+        col += w;
+    }
+
+    size_t *points = realloc(lin->wrap_points, count * sizeof(size_t));
+    if (points == NULL) {
+        // Without wrap points, the line is just displayed as one row
+        free(lin->wrap_points);
+        lin->wrap_points = NULL;
+        lin->wrap_count = 1;
+        lin->wrap_width = 0;
+        return 1;
+    }
+    lin->wrap_points = points;
+    lin->wrap_points[0] = 0;
+
+    size_t row = 1;
+    size_t i = 0;
+    col = 0;
+    for (size_t offset = 0; offset < lin->bytes; ++i) {
+        offset += utf8_decode(lin->data + offset, lin->bytes - offset, &c);
+        int w = character_width(c);
+        if (col + w > width && col > 0) {
+            lin->wrap_points[row++] = i;
+            col = 0;
+        }
+        col += w;
+    }
+    lin->wrap_count = count;
+    lin->wrap_width = width;
+    return count;
+}
+
+size_t line_wrap_row(Line *lin, size_t index) {
+    if (lin == NULL || lin->wrap_points == NULL || lin->wrap_count <= 1)
+        return 0;
+
+    // Binary search for the last row starting at or before 'index'
+    size_t lo = 0;
+    size_t hi = lin->wrap_count - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if (lin->wrap_points[mid] <= index) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+static void buffer_set_cursor_x(Buffer *buf, Line *lin, size_t cursor_x) {
+    buf->cursor_x = 0;
+    buf->render_cursor_x = 0;
+    wint_t c;
+    for (size_t offset = 0; buf->cursor_x < cursor_x && offset < lin->bytes;
+         buf->cursor_x++) {
+        offset += utf8_decode(lin->data + offset, lin->bytes - offset, &c);
+        buf->render_cursor_x += character_width(c);
+    }
+}
+
+void buffer_move_cursor_row_down(Buffer *buf, size_t width) {
+    if (buf == NULL)
+        return;
+    Line *lin = buffer_find_line(buf, buf->cursor_y);
+    if (lin == NULL)
+        return;
+
+    size_t rows = line_wrap(lin, width);
+    size_t row = line_wrap_row(lin, buf->cursor_x);
+    if (row + 1 >= rows) {
+        buffer_move_cursor_down(buf);
+        return;
+    }
+
+    // Keep the offset inside of the row, but stay inside of the next row
+    size_t x = lin->wrap_points[row + 1] + buf->cursor_x -
+               lin->wrap_points[row];
+    size_t end = row + 2 < rows ? lin->wrap_points[row + 2] : lin->size;
+    if (x >= end) {
+        x = end - 1;
+    }
+    buffer_set_cursor_x(buf, lin, x);
+}
+
+void buffer_move_cursor_row_up(Buffer *buf, size_t width) {
+    if (buf == NULL)
+        return;
+    Line *lin = buffer_find_line(buf, buf->cursor_y);
+    if (lin == NULL)
+        return;
+
+    line_wrap(lin, width);
+    size_t row = line_wrap_row(lin, buf->cursor_x);
+    if (row == 0) {
+        if (buf->cursor_y == 0)
+            return;
+        // Go to the last row of the previous line
+        buffer_move_cursor_up(buf);
+        lin = lin->prev;
+        size_t rows = line_wrap(lin, width);
+        if (rows > 1) {
+            buffer_set_cursor_x(buf, lin, lin->wrap_points[rows - 1]);
+        }
+        return;
+    }
+
+    size_t x = lin->wrap_points[row - 1] + buf->cursor_x -
+               lin->wrap_points[row];
+    if (x >= lin->wrap_points[row]) {
+        x = lin->wrap_points[row] - 1;
+    }
+    buffer_set_cursor_x(buf, lin, x);
+}
+
+void buffer_scroll_wrapped(Buffer *buf, size_t width) {
+    if (buf == NULL || buf->state == NULL)
+        return;
+    size_t height = buf->state->max_y;
+
+    if (buf->cursor_y < buf->scroll_y) {
+        buf->scroll_y = buf->cursor_y;
+    }
+    // Every line takes up at least one row, lines that are further away
+    // from the cursor than the window is high can't be on the screen
+    if (buf->cursor_y - buf->scroll_y >= height) {
+        buf->scroll_y = buf->cursor_y - height + 1;
+    }
+
+    Line *top = buffer_find_line(buf, buf->scroll_y);
+    if (top == NULL)
+        return;
+
+    // Rows from the top of the screen until the cursor (inclusive)
+    size_t rows = 0;
+    Line *itr = top;
+    for (size_t i = buf->scroll_y; i < buf->cursor_y && itr != NULL;
+         ++i, itr = itr->next) {
+        rows += line_wrap(itr, width);
+    }
+    line_wrap(itr, width);
+    rows += line_wrap_row(itr, buf->cursor_x) + 1;
+
+    while (rows > height && buf->scroll_y < buf->cursor_y) {
+        rows -= line_wrap(top, width);
+        top = top->next;
+        buf->scroll_y++;
+    }
+}
+
+void buffer_move_cursor_to_line(Buffer *buf, size_t index) {
+    if (buf == NULL || buf->size == 0)
+        return;
+    buf->cursor_y = index < buf->size ? index : buf->size - 1;
+    buf->cursor_x = 0;
+    buf->render_cursor_x = 0;
+}
+
+void buffer_scroll_to_cursor(Buffer *buf) {
+    if (buf == NULL || buf->state == NULL)
+        return;
+    size_t height = buf->state->max_y;
+
+    if (buf->cursor_y < buf->scroll_y) {
+        buf->scroll_y = buf->cursor_y;
+    } else if (height > 0 && buf->cursor_y >= buf->scroll_y + height) {
+        buf->scroll_y = buf->cursor_y - height + 1;
+    }
+}
+
+void buffer_scroll_down(Buffer *buf, size_t lines) {
+    if (buf == NULL || buf->state == NULL)
+        return;
+    size_t height = buf->state->max_y;
+
+    // Scrolling stops once the last line is at the bottom of the screen
+    size_t max_scroll = buf->size > height ? buf->size - height : 0;
+    buf->scroll_y = buf->scroll_y + lines < max_scroll ? buf->scroll_y + lines
+                                                       : max_scroll;
+    if (buf->cursor_y < buf->scroll_y) {
+        buffer_move_cursor_to_line(buf, buf->scroll_y);
+    }
+}
+
+void buffer_scroll_up(Buffer *buf, size_t lines) {
+    if (buf == NULL || buf->state == NULL)
+        return;
+    size_t height = buf->state->max_y;
+
+    buf->scroll_y = buf->scroll_y > lines ? buf->scroll_y - lines : 0;
+    if (height > 0 && buf->cursor_y >= buf->scroll_y + height) {
+        buffer_move_cursor_to_line(buf, buf->scroll_y + height - 1);
+    }
+}
+
+// Motions scan the line once starting at the cursor, 'render_x' is updated
+// on the way so that the cursor never needs to be searched for again.
+
+static int character_class(wint_t c) {
+    if (iswspace(c))
+        return 0;
+    if (iswalnum(c) || c == '_')
+        return 2;
+    return 1;
+}
+
+static bool motion_start(Buffer *buf, Motion *m) {
+    m->lin = buffer_find_line(buf, buf->cursor_y);
+    if (m->lin == NULL)
+        return false;
+    m->y = buf->cursor_y;
+    m->x = buf->cursor_x < m->lin->size ? buf->cursor_x : m->lin->size;
+    m->render_x = buf->render_cursor_x;
+    m->offset = line_offset(m->lin, m->x);
+    motion_decode(m);
+    return true;
+}
+
+static void motion_decode(Motion *m) {
+    if (m->offset >= m->lin->bytes) {
+        m->c = WEOF;
+        m->len = 0;
+        return;
+    }
+    m->len = utf8_decode(m->lin->data + m->offset, m->lin->bytes - m->offset,
+                         &m->c);
+}
+
+static bool motion_next(Motion *m) {
+    if (m->c == WEOF)
+        return false;
+    m->render_x += character_width(m->c);
+    m->offset += m->len;
+    m->x++;
+    motion_decode(m);
+    return true;
+}
+
+static bool motion_prev(Motion *m) {
+    if (m->x == 0)
+        return false;
+    m->offset = utf8_prev(m->lin->data, m->offset);
+    m->x--;
+    motion_decode(m);
+    m->render_x -= character_width(m->c);
+    return true;
+}
+
+static bool motion_forward(Buffer *buf, Motion *m) {
+    if (motion_next(m))
+        return true;
+    if (m->y + 1 >= buf->size)
+        return false;
+    m->y++;
+    m->lin = m->lin->next;
+    m->offset = 0;
+    m->x = 0;
+    m->render_x = 0;
+    motion_decode(m);
+    return true;
+}
+
+static bool motion_backward(Motion *m) {
+    if (motion_prev(m))
+        return true;
+    if (m->y == 0)
+        return false;
+    m->y--;
+    m->lin = m->lin->prev;
+    m->x = m->lin->size;
+    m->render_x = 0;
+    wint_t c;
+    for (m->offset = 0; m->offset < m->lin->bytes;) {
+        m->offset += utf8_decode(m->lin->data + m->offset,
+                                 m->lin->bytes - m->offset, &c);
+        m->render_x += character_width(c);
+    }
+    motion_decode(m);
+    return true;
+}
+
+static void buffer_apply_motion(Buffer *buf, Motion *m) {
+    if (m->c == WEOF) {
+        motion_prev(m);
+    }
+    buf->cursor_y = m->y;
+    buf->cursor_x = m->x;
+    buf->render_cursor_x = m->render_x;
+}
+
+void buffer_move_cursor_word_next(Buffer *buf) {
+    Motion m;
+    if (buf == NULL || !motion_start(buf, &m))
+        return;
+
+    // Skip the rest of the word the cursor is on
+    if (m.c != WEOF) {
+        int class = character_class(m.c);
+        while (m.c != WEOF && class != 0 && character_class(m.c) == class) {
+            motion_next(&m);
+        }
+    }
+    // Skip whitespace, an empty line counts as a word
+    while (m.c == WEOF || character_class(m.c) == 0) {
+        if (m.lin->size == 0 && m.y != buf->cursor_y)
+            break;
+        if (!motion_forward(buf, &m))
+            break;
+    }
+    buffer_apply_motion(buf, &m);
+}
+
+void buffer_move_cursor_word_prev(Buffer *buf) {
+    Motion m;
+    if (buf == NULL || !motion_start(buf, &m) || !motion_backward(&m))
+        return;
+
+    while (m.c == WEOF || character_class(m.c) == 0) {
+        if (m.lin->size == 0)
+            break;
+        if (!motion_backward(&m))
+            break;
+    }
+    if (m.c != WEOF) {
+        int class = character_class(m.c);
+        Motion prev = m;
+        while (motion_prev(&prev) && character_class(prev.c) == class) {
+            m = prev;
+        }
+    }
+    buffer_apply_motion(buf, &m);
+}
+
+void buffer_move_cursor_word_end(Buffer *buf) {
+    Motion m;
+    if (buf == NULL || !motion_start(buf, &m) || !motion_forward(buf, &m))
+        return;
+
+    while (m.c == WEOF || character_class(m.c) == 0) {
+        if (!motion_forward(buf, &m))
+            break;
+    }
+    if (m.c != WEOF) {
+        int class = character_class(m.c);
+        Motion next = m;
+        while (motion_next(&next) && next.c != WEOF &&
+               character_class(next.c) == class) {
+            m = next;
+        }
+    }
+    buffer_apply_motion(buf, &m);
+}
+
+bool buffer_move_cursor_find_char(Buffer *buf, wint_t c) {
+    Motion m;
+    if (buf == NULL || !motion_start(buf, &m) || m.c == WEOF)
+        return false;
+
+    motion_next(&m);
+    while (m.c != WEOF && m.c != c) {
+        motion_next(&m);
+    }
+    if (m.c == WEOF)
+        return false;
+    buffer_apply_motion(buf, &m);
+    return true;
+}
+
+void buffer_move_cursor_line_start(Buffer *buf) {
+    if (buf == NULL)
+        return;
+    buf->cursor_x = 0;
+    buf->render_cursor_x = 0;
+}
+
+void buffer_move_cursor_line_end(Buffer *buf) {
+    Motion m;
+    if (buf == NULL || !motion_start(buf, &m))
+        return;
+
+    while (motion_next(&m))
+        ;
+    buffer_apply_motion(buf, &m);
+}
+
+void buffer_clamp_cursor(Buffer *buf) {
+    if (buf == NULL || buf->size == 0)
+        return;
+    bool moved = buf->cursor_y >= buf->size;
+    if (moved) {
+        buf->cursor_y = buf->size - 1;
+    }
+    Line *lin = buffer_find_line(buf, buf->cursor_y);
+    // A cursor that is in range keeps its rendered column, recomputing it
+    // would walk the line up to the cursor
+    if (!moved && (buf->cursor_x < lin->size || buf->cursor_x == 0))
+        return;
+    size_t cursor_x = buf->cursor_x;
+    if (cursor_x >= lin->size) {
+        cursor_x = lin->size > 0 ? lin->size - 1 : 0;
+    }
+    buffer_set_cursor_x(buf, lin, cursor_x);
+}
+
+static size_t line_substitute(Line *lin, const Substitution *sub,
+                              char **scratch, size_t *scratch_cap) {
+    if (lin->bytes < sub->pattern_len)
+        return 0;
+    const char *match = memmem(lin->data, lin->bytes, sub->pattern,
+                               sub->pattern_len);
+    if (match == NULL)
+        return 0;
+
+    // Every match grows the line by at most 'replacement_len' bytes
+    size_t matches_max = sub->global ? lin->bytes / sub->pattern_len : 1;
+    size_t needed = lin->bytes + matches_max * sub->replacement_len;
+    if (needed > *scratch_cap) {
+        char *tmp = realloc(*scratch, needed);
+        if (tmp == NULL)
+            return 0;
+        *scratch = tmp;
+        *scratch_cap = needed;
+    }
+    char *result = *scratch;
+
+    // The pattern is valid UTF-8, so a match always starts and ends at the
+    // boundary of a character
+    size_t replaced = 0;
+    size_t len = 0;
+    const char *start = lin->data;
+    const char *end = lin->data + lin->bytes;
+    while (match != NULL) {
+        memcpy(result + len, start, match - start);
+        len += match - start;
+        memcpy(result + len, sub->replacement, sub->replacement_len);
+        len += sub->replacement_len;
+        start = match + sub->pattern_len;
+        if (++replaced == matches_max)
+            break;
+        match = memmem(start, end - start, sub->pattern, sub->pattern_len);
+    }
+    memcpy(result + len, start, end - start);
+    len += end - start;
+
+    if (!line_reserve(lin, len))
+        return 0;
+    memcpy(lin->data, result, len);
+    lin->bytes = len;
+    // Removing the pattern may join invalid bytes around it, the line is
+    // counted again since all of it has been copied anyway
+    lin->size = utf8_length(result, len);
+    lin->wrap_width = 0;
+    return replaced;
+}
+
+static void *buffer_substitute_worker(void *arg) {
+    Substitution *sub = arg;
+    PROFILE_BEGIN(PROFILE_SUBSTITUTE_WORKER);
+    char *scratch = NULL;
+    size_t scratch_cap = 0;
+    for (size_t i = 0; i < sub->count; ++i) {
+        sub->replaced +=
+            line_substitute(sub->lines[i], sub, &scratch, &scratch_cap);
+    }
+    free(scratch);
+    PROFILE_END(PROFILE_SUBSTITUTE_WORKER);
+    return NULL;
+}
+
+size_t buffer_substitute(Buffer *buf, size_t first, size_t last,
+                         const wchar_t *pattern, const wchar_t *replacement,
+                         bool global) {
+    if (buf == NULL || pattern == NULL || replacement == NULL ||
+        *pattern == L'\0' || first > last || last >= buf->size)
+        return 0;
+    buffer_save_wait_walk(buf);
+
+    // Matching is done on the encoded lines, no line needs to be decoded
+    size_t pattern_len;
+    size_t replacement_len;
+    char *pattern_str = utf8_from_wcs(pattern, &pattern_len);
+    char *replacement_str = utf8_from_wcs(replacement, &replacement_len);
+    if (pattern_str == NULL || replacement_str == NULL) {
+        free(pattern_str);
+        free(replacement_str);
+        return 0;
+    }
+
+    size_t count = last - first + 1;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = 1;
+    if (cpus > 1 && count >= BUFFER_SUBSTITUTE_THREAD_LINES) {
+        threads = count / BUFFER_SUBSTITUTE_THREAD_LINES;
+        if (threads > (size_t)cpus) {
+            threads = cpus;
+        }
+    }
+
+    // Lines don't share any state, every thread gets its own range of the
+    // line index. The first range is handled by the calling thread.
+    Substitution subs[threads];
+    pthread_t ids[threads];
+    bool started[threads];
+    size_t per_thread = count / threads;
+    for (size_t t = 0; t < threads; ++t) {
+        subs[t] = (Substitution){
+            .lines = &buf->line_index[first + t * per_thread],
+            .count = t + 1 == threads ? count - t * per_thread : per_thread,
+            .pattern = pattern_str,
+            .pattern_len = pattern_len,
+            .replacement = replacement_str,
+            .replacement_len = replacement_len,
+            .global = global,
+        };
+        started[t] = t > 0 && pthread_create(&ids[t], NULL,
+                                             buffer_substitute_worker,
+                                             &subs[t]) == 0;
+    }
+
+    size_t replaced = 0;
+    for (size_t t = 0; t < threads; ++t) {
+        if (started[t]) {
+            pthread_join(ids[t], NULL);
+        } else {
+            buffer_substitute_worker(&subs[t]);
+        }
+        replaced += subs[t].replaced;
+    }
+    free(pattern_str);
+    free(replacement_str);
+
+    // The cursor may be behind the end of its line now
+    Line *lin = buffer_find_line(buf, buf->cursor_y);
+    if (replaced > 0 && lin != NULL) {
+        size_t cursor_x = buf->cursor_x;
+        if (cursor_x >= lin->size) {
+            cursor_x = lin->size > 0 ? lin->size - 1 : 0;
+        }
+        buffer_set_cursor_x(buf, lin, cursor_x);
+    }
+    // Every line in the range has been looked at
+    buffer_trim(buf);
+    return replaced;
+}
+
+static int cursor_compare(const Cursor *a, const Cursor *b) {
+    if (a->y != b->y)
+        return a->y < b->y ? -1 : 1;
+    if (a->x != b->x)
+        return a->x < b->x ? -1 : 1;
+    return 0;
+}
+
+static bool buffer_cursors_reserve(Buffer *buf, size_t count) {
+    if (count <= buf->cursor_cap)
+        return true;
+    size_t cap = buf->cursor_cap == 0 ? 16 : buf->cursor_cap * 2;
+    while (cap < count) {
+        cap *= 2;
+    }
+    Cursor *tmp = realloc(buf->cursors, cap * sizeof(Cursor));
+    if (tmp == NULL)
+        return false;
+    buf->cursors = tmp;
+    buf->cursor_cap = cap;
+    return true;
+}
+
+size_t buffer_find_cursor(Buffer *buf, size_t cursor_x, size_t cursor_y) {
+    if (buf == NULL)
+        return 0;
+    Cursor key = {.x = cursor_x, .y = cursor_y};
+    size_t low = 0;
+    size_t high = buf->cursor_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (cursor_compare(&buf->cursors[mid], &key) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+bool buffer_add_cursor(Buffer *buf, size_t cursor_x, size_t cursor_y) {
+    if (buf == NULL)
+        return false;
+    Line *lin = buffer_find_line(buf, cursor_y);
+    if (lin == NULL || cursor_x >= (lin->size > 0 ? lin->size : 1))
+        return false;
+    if (cursor_x == buf->cursor_x && cursor_y == buf->cursor_y)
+        return true;
+
+    size_t index = buffer_find_cursor(buf, cursor_x, cursor_y);
+    Cursor cursor = {.x = cursor_x, .y = cursor_y};
+    if (index < buf->cursor_count &&
+        cursor_compare(&buf->cursors[index], &cursor) == 0)
+        return true;
+
+    if (!buffer_cursors_reserve(buf, buf->cursor_count + 1))
+        return false;
+    memmove(&buf->cursors[index + 1], &buf->cursors[index],
+            (buf->cursor_count - index) * sizeof(Cursor));
+    buf->cursors[index] = cursor;
+    buf->cursor_count++;
+    return true;
+}
+
+size_t buffer_add_cursor_lines(Buffer *buf, size_t first, size_t last) {
+    if (buf == NULL || buf->size == 0)
+        return 0;
+    if (last >= buf->size) {
+        last = buf->size - 1;
+    }
+
+    size_t added = 0;
+    for (size_t y = first; y <= last; ++y) {
+        Line *lin = buf->line_index[y];
+        size_t x = buf->cursor_x;
+        if (x >= lin->size) {
+            x = lin->size > 0 ? lin->size - 1 : 0;
+        }
+        size_t count = buf->cursor_count;
+        if (!buffer_add_cursor(buf, x, y))
+            break;
+        added += buf->cursor_count - count;
+    }
+    return added;
+}
+
+bool buffer_add_cursor_next_match(Buffer *buf) {
+    if (buf == NULL)
+        return false;
+    Line *lin = buffer_find_line(buf, buf->cursor_y);
+    if (lin == NULL || buf->cursor_x >= lin->size)
+        return false;
+
+    // The word under the primary cursor, as bytes and characters
+    size_t start = line_offset(lin, buf->cursor_x);
+    wint_t c;
+    size_t end = start + utf8_decode(lin->data + start, lin->bytes - start, &c);
+    int class = character_class(c);
+    if (class == 0)
+        return false;
+    size_t word_x = buf->cursor_x;
+    while (start > 0) {
+        size_t prev = utf8_prev(lin->data, start);
+        utf8_decode(lin->data + prev, start - prev, &c);
+        if (character_class(c) != class)
+            break;
+        start = prev;
+        word_x--;
+    }
+    while (end < lin->bytes) {
+        size_t len = utf8_decode(lin->data + end, lin->bytes - end, &c);
+        if (character_class(c) != class)
+            break;
+        end += len;
+    }
+    const char *word = lin->data + start;
+    size_t word_len = end - start;
+    size_t cursor_in_word = buf->cursor_x - word_x;
+
+    // Searching starts behind the word of the last cursor
+    Cursor last = {.x = buf->cursor_x, .y = buf->cursor_y};
+    if (buf->cursor_count > 0 &&
+        cursor_compare(&buf->cursors[buf->cursor_count - 1], &last) > 0) {
+        last = buf->cursors[buf->cursor_count - 1];
+    }
+    Line *itr = buf->line_index[last.y];
+    size_t from = last.x >= cursor_in_word ? last.x - cursor_in_word + 1 : 0;
+    size_t offset = line_offset(itr, from);
+
+    // Every line is searched once, the line of the last cursor twice since
+    // the search may wrap around to the start of it
+    size_t scanned = 0;
+    for (size_t i = 0, y = last.y; i <= buf->size; ++i) {
+        while (offset + word_len <= itr->bytes) {
+            const char *match = memmem(itr->data + offset, itr->bytes - offset,
+                                       word, word_len);
+            if (match == NULL)
+                break;
+            size_t match_offset = match - itr->data;
+            offset = match_offset + 1;
+
+            // Only whole words match
+            wint_t before = WEOF;
+            wint_t after = WEOF;
+            if (match_offset > 0) {
+                size_t prev = utf8_prev(itr->data, match_offset);
+                utf8_decode(itr->data + prev, match_offset - prev, &before);
+            }
+            if (match_offset + word_len < itr->bytes) {
+                utf8_decode(itr->data + match_offset + word_len,
+                            itr->bytes - match_offset - word_len, &after);
+            }
+            if ((before != WEOF && character_class(before) == class) ||
+                (after != WEOF && character_class(after) == class))
+                continue;
+
+            size_t x = utf8_length(itr->data, match_offset) + cursor_in_word;
+            Cursor cursor = {.x = x, .y = y};
+            size_t index = buffer_find_cursor(buf, x, y);
+            bool exists =
+                (x == buf->cursor_x && y == buf->cursor_y) ||
+                (index < buf->cursor_count &&
+                 cursor_compare(&buf->cursors[index], &cursor) == 0);
+            if (!exists) {
+                // A long search loaded blocks that are not used anymore
+                if (scanned > BUFFER_BLOCK_SIZE) {
+                    buffer_touch_line(buf, itr);
+                    buffer_trim(buf);
+                }
+                return buffer_add_cursor(buf, x, y);
+            }
+        }
+        scanned += itr->bytes;
+        y = y + 1 < buf->size ? y + 1 : 0;
+        itr = buf->line_index[y];
+        offset = 0;
+    }
+    buffer_trim(buf);
+    return false;
+}
+
+void buffer_clear_cursors(Buffer *buf) {
+    if (buf != NULL) {
+        buf->cursor_count = 0;
+    }
+}
+
+static size_t buffer_cursors_merge(Buffer *buf, size_t primary) {
+    size_t count = 0;
+    for (size_t i = 0; i < buf->cursor_count; ++i) {
+        if (count > 0 && cursor_compare(&buf->cursors[count - 1],
+                                        &buf->cursors[i]) == 0) {
+            if (i == primary) {
+                primary = count - 1;
+            }
+            continue;
+        }
+        if (i == primary) {
+            primary = count;
+        }
+        buf->cursors[count++] = buf->cursors[i];
+    }
+    buf->cursor_count = count;
+    return primary;
+}
+
+static size_t buffer_cursors_begin(Buffer *buf) {
+    if (!buffer_cursors_reserve(buf, buf->cursor_count + 1))
+        return buf->cursor_count;
+
+    // Edits, follow mode or substitutions may have moved the content away
+    // from under a cursor. Clamping keeps the order of the list.
+    while (buf->cursor_count > 0 &&
+           buf->cursors[buf->cursor_count - 1].y >= buf->size) {
+        buf->cursor_count--;
+    }
+    for (size_t i = 0; i < buf->cursor_count; ++i) {
+        Line *lin = buf->line_index[buf->cursors[i].y];
+        if (buf->cursors[i].x >= lin->size) {
+            buf->cursors[i].x = lin->size > 0 ? lin->size - 1 : 0;
+        }
+    }
+
+    Cursor cursor = {.x = buf->cursor_x, .y = buf->cursor_y};
+    size_t primary = buffer_find_cursor(buf, cursor.x, cursor.y);
+    memmove(&buf->cursors[primary + 1], &buf->cursors[primary],
+            (buf->cursor_count - primary) * sizeof(Cursor));
+    buf->cursors[primary] = cursor;
+    buf->cursor_count++;
+    return buffer_cursors_merge(buf, primary);
+}
+
+static void buffer_cursors_end(Buffer *buf, size_t primary) {
+    primary = buffer_cursors_merge(buf, primary);
+    Cursor cursor = buf->cursors[primary];
+    buf->cursor_count--;
+    memmove(&buf->cursors[primary], &buf->cursors[primary + 1],
+            (buf->cursor_count - primary) * sizeof(Cursor));
+
+    buf->cursor_y = cursor.y;
+    buffer_set_cursor_x(buf, buf->line_index[cursor.y], cursor.x);
+}
+
+static void line_offsets(Line *lin, size_t *indexes, size_t count) {
+    if (lin->bytes == lin->size) {
+        for (size_t i = 0; i < count; ++i) {
+            if (indexes[i] > lin->bytes) {
+                indexes[i] = lin->bytes;
+            }
+        }
+        return;
+    }
+
+    size_t offset = 0;
+    size_t x = 0;
+    wint_t c;
+    for (size_t i = 0; i < count; ++i) {
+        while (x < indexes[i] && offset < lin->bytes) {
+            offset += utf8_decode(lin->data + offset, lin->bytes - offset, &c);
+            x++;
+        }
+        indexes[i] = offset;
+    }
+}
+
+static void line_delete_chars(Line *lin, const size_t *offsets,
+                              size_t count) {
+    wint_t c;
+    size_t last = offsets[count - 1];
+    last += utf8_decode(lin->data + last, lin->bytes - last, &c);
+    size_t around = line_count_around(lin->data, lin->bytes, offsets[0], last);
+
+    // Everything between two deleted characters is moved to the front once
+    size_t dst = offsets[0];
+    for (size_t i = 0; i < count; ++i) {
+        wint_t c;
+        size_t src = offsets[i] + utf8_decode(lin->data + offsets[i],
+                                             lin->bytes - offsets[i], &c);
+        size_t end = i + 1 < count ? offsets[i + 1] : lin->bytes;
+        memmove(lin->data + dst, lin->data + src, end - src);
+        dst += end - src;
+    }
+    size_t removed = lin->bytes - dst;
+    lin->bytes = dst;
+    lin->size = lin->size - around +
+                line_count_around(lin->data, lin->bytes, offsets[0],
+                                  last - removed);
+    lin->wrap_width = 0;
+}
+
+void buffer_cursors_append_char(Buffer *buf, wint_t c) {
+    if (buf == NULL)
+        return;
+    buffer_save_wait_walk(buf);
+    size_t primary = buffer_cursors_begin(buf);
+    if (primary == buf->cursor_count)
+        return;
+
+    char str[UTF8_MAX_BYTES];
+    size_t len = utf8_encode(c, str);
+    size_t *offsets = malloc(buf->cursor_count * sizeof(size_t));
+    if (offsets == NULL) {
+        buffer_cursors_end(buf, primary);
+        return;
+    }
+
+    // Cursors are handled line by line, every line is touched once
+    Cursor *cursors = buf->cursors;
+    for (size_t i = 0, count; i < buf->cursor_count; i += count) {
+        Line *lin = buf->line_index[cursors[i].y];
+        for (count = 1; i + count < buf->cursor_count &&
+                        cursors[i + count].y == cursors[i].y;
+             ++count)
+            ;
+        if (!line_reserve(lin, lin->bytes + count * len))
+            continue;
+
+        if (lin->size == 0) {
+            // Just like with a single cursor, the cursor stays in front of
+            // the first character of an empty line
+            memcpy(lin->data, str, len);
+            lin->bytes = len;
+            lin->size = 1;
+            lin->wrap_width = 0;
+            continue;
+        }
+
+        // Each character is inserted behind the one at its cursor, the
+        // line is shifted starting at the end so every byte moves once
+        for (size_t k = 0; k < count; ++k) {
+            offsets[k] = cursors[i + k].x + 1;
+        }
+        line_offsets(lin, offsets, count);
+        size_t end = lin->bytes;
+        for (size_t k = count; k-- > 0;) {
+            memmove(lin->data + offsets[k] + (k + 1) * len,
+                    lin->data + offsets[k], end - offsets[k]);
+            memcpy(lin->data + offsets[k] + k * len, str, len);
+            end = offsets[k];
+        }
+        lin->bytes += count * len;
+        lin->size += count;
+        lin->wrap_width = 0;
+
+        // Every cursor moves onto its new character, which is behind the
+        // k characters inserted for the cursors in front of it
+        for (size_t k = 0; k < count; ++k) {
+            cursors[i + k].x += k + 1;
+        }
+    }
+    free(offsets);
+    buffer_cursors_end(buf, primary);
+}
+
+void buffer_cursors_delete_char(Buffer *buf) {
+    if (buf == NULL)
+        return;
+    buffer_save_wait_walk(buf);
+    size_t primary = buffer_cursors_begin(buf);
+    if (primary == buf->cursor_count)
+        return;
+
+    size_t *offsets = malloc(buf->cursor_count * sizeof(size_t));
+    if (offsets == NULL) {
+        buffer_cursors_end(buf, primary);
+        return;
+    }
+
+    Cursor *cursors = buf->cursors;
+    for (size_t i = 0, count; i < buf->cursor_count; i += count) {
+        Line *lin = buf->line_index[cursors[i].y];
+        for (count = 1; i + count < buf->cursor_count &&
+                        cursors[i + count].y == cursors[i].y;
+             ++count)
+            ;
+        if (lin->size == 0 || !line_reserve(lin, lin->bytes))
+            continue;
+
+        for (size_t k = 0; k < count; ++k) {
+            offsets[k] = cursors[i + k].x;
+        }
+        line_offsets(lin, offsets, count);
+        size_t size = lin->size;
+        line_delete_chars(lin, offsets, count);
+
+        // The k deleted characters in front of a cursor move it to the
+        // left. Deleting the last character moves onto the new last one,
+        // which is the case for every cursor of a run of cursors that
+        // reaches the end of the line.
+        for (size_t k = 0; k < count; ++k) {
+            size_t x = cursors[i + k].x;
+            cursors[i + k].x = x - k;
+            if (x - k > 0 && x + (count - 1 - k) == size - 1) {
+                cursors[i + k].x--;
+            }
+            // Joined invalid bytes leave fewer characters than deleted
+            if (cursors[i + k].x >= lin->size) {
+                cursors[i + k].x = lin->size > 0 ? lin->size - 1 : 0;
+            }
+        }
+    }
+    free(offsets);
+    buffer_cursors_end(buf, primary);
+}
+
+void buffer_cursors_backspace(Buffer *buf) {
+    if (buf == NULL)
+        return;
+    buffer_save_wait_walk(buf);
+    size_t primary = buffer_cursors_begin(buf);
+    if (primary == buf->cursor_count)
+        return;
+
+    size_t *offsets = malloc(buf->cursor_count * sizeof(size_t));
+    if (offsets == NULL) {
+        buffer_cursors_end(buf, primary);
+        return;
+    }
+
+    Cursor *cursors = buf->cursors;
+    for (size_t i = 0, count; i < buf->cursor_count; i += count) {
+        Line *lin = buf->line_index[cursors[i].y];
+        for (count = 1; i + count < buf->cursor_count &&
+                        cursors[i + count].y == cursors[i].y;
+             ++count)
+            ;
+        // Only the first cursor of a line can be at its start
+        size_t skip = cursors[i].x == 0 ? 1 : 0;
+        if (count == skip || !line_reserve(lin, lin->bytes))
+            continue;
+
+        for (size_t k = skip; k < count; ++k) {
+            offsets[k - skip] = cursors[i + k].x - 1;
+        }
+        line_offsets(lin, offsets, count - skip);
+        line_delete_chars(lin, offsets, count - skip);
+        for (size_t k = skip; k < count; ++k) {
+            cursors[i + k].x -= k - skip + 1;
+            // Joined invalid bytes leave fewer characters than deleted
+            if (cursors[i + k].x >= lin->size) {
+                cursors[i + k].x = lin->size > 0 ? lin->size - 1 : 0;
+            }
+        }
+    }
+    free(offsets);
+    buffer_cursors_end(buf, primary);
+}
+
+void buffer_cursors_insert_line(Buffer *buf) {
+    if (buf == NULL)
+        return;
+    buffer_save_wait_walk(buf);
+    size_t primary = buffer_cursors_begin(buf);
+    if (primary == buf->cursor_count)
+        return;
+
+    // The lines that have a cursor, every one of them gets a new line
+    size_t *lines = malloc(buf->cursor_count * sizeof(size_t));
+    Line **new_lines = malloc(buf->cursor_count * sizeof(Line *));
+    size_t count = 0;
+    if (lines != NULL && new_lines != NULL) {
+        for (size_t i = 0; i < buf->cursor_count; ++i) {
+            if (count == 0 || lines[count - 1] != buf->cursors[i].y) {
+                lines[count++] = buf->cursors[i].y;
+            }
+        }
+        for (size_t i = 0; i < count; ++i) {
+            new_lines[i] = calloc(1, sizeof(Line));
+            if (new_lines[i] == NULL) {
+                while (i-- > 0) {
+                    free(new_lines[i]);
+                }
+                count = 0;
+                break;
+            }
+        }
+    }
+    if (count == 0 || !buffer_index_reserve(buf, buf->size + count)) {
+        for (size_t i = 0; i < count; ++i) {
+            free(new_lines[i]);
+        }
+        free(lines);
+        free(new_lines);
+        buffer_cursors_end(buf, primary);
+        return;
+    }
+
+    // The index is rebuilt from the end, every entry is moved once
+    size_t src = buf->size;
+    size_t dst = buf->size + count;
+    for (size_t i = count; i-- > 0;) {
+        size_t moved = src - (lines[i] + 1);
+        dst -= moved;
+        memmove(&buf->line_index[dst], &buf->line_index[lines[i] + 1],
+                moved * sizeof(Line *));
+        buf->line_index[--dst] = new_lines[i];
+        src = lines[i] + 1;
+
+        Line *curr_lin = buf->line_index[lines[i]];
+        Line *lin = new_lines[i];
+        lin->prev = curr_lin;
+        lin->next = curr_lin->next;
+        if (curr_lin == buf->last_line) {
+            buf->last_line = lin;
+        } else {
+            curr_lin->next->prev = lin;
+        }
+        curr_lin->next = lin;
+    }
+    buf->size += count;
+
+    // Cursors move to the new line below their own one, which is behind
+    // the new lines of the lines in front of it
+    for (size_t i = 0, k = 0; i < buf->cursor_count; ++i) {
+        while (lines[k] != buf->cursors[i].y) {
+            k++;
+        }
+        buf->cursors[i].y += k + 1;
+        buf->cursors[i].x = 0;
+    }
+    free(lines);
+    free(new_lines);
+    buffer_cursors_end(buf, primary);
+}
@@ -2,30 +2,172 @@
 #define _BUFFER_H_
 
 #include "defs.h"
+#include "utf8.h"
+#include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
 #include <wctype.h>
 
-#define BUFFER_MAX_LINE_SIZE 512
-
-typedef struct _Character_ {
-    wint_t value;
-
-    struct _Character_ *next;
-    struct _Character_ *prev;
-} Character;
+#define BUFFER_FOLLOW_CHUNK_SIZE 65536
+// substitutions on less lines than this are not split across threads
+#define BUFFER_SUBSTITUTE_THREAD_LINES 16384
+// Files larger than State.max_mem are mapped instead of read, the mapping
+// is divided into blocks of this size (a multiple of the page size)
+#ifndef BUFFER_BLOCK_SIZE
+#define BUFFER_BLOCK_SIZE ((size_t)1 << 20)
+#endif
+// maximum amount of files that are mapped at once (see BufferMapping)
+#define BUFFER_MAPPINGS_MAX 64
+#define BUFFER_DEFAULT_MAX_MEM ((size_t)256 << 20)
+// a save reports its progress after every chunk it has written
+#define BUFFER_SAVE_CHUNK_SIZE ((size_t)1 << 20)
+// marks the end of the list of used blocks
+#define BUFFER_BLOCK_NONE SIZE_MAX
 
 typedef struct _Line_ {
+    // Content of the line as UTF-8 without the trailing \n. Lines that have
+    // been read from the file point into the buffer's 'file_data' and have a
+    // 'capacity' of 0, they get their own copy once they are edited. The
+    // copy is preceded by a reference count, a running save holds a
+    // reference to it as well (see line_reserve).
+    char *data;
+    size_t bytes;
+    size_t capacity;
+    // amount of characters, every invalid byte counts as one character
     size_t size;
-    Character *chars;
-    Character *first_char;
-    Character *last_char;
+
+    // Cached soft wrap positions (see line_wrap), 'wrap_points' holds the
+    // index of the first character of every visual row. The cache is only
+    // valid if 'wrap_width' matches the width the line is rendered with,
+    // editing the line resets 'wrap_width' to 0.
+    size_t *wrap_points;
+    size_t wrap_count;
+    size_t wrap_width;
 
     struct _Line_ *next;
     struct _Line_ *prev;
 } Line;
 
+// A range of lines that buffer_substitute hands to one thread
+typedef struct _Substitution_ {
+    Line **lines;
+    size_t count;
+    // UTF-8 encoded, the lengths are in bytes
+    const char *pattern;
+    size_t pattern_len;
+    const char *replacement;
+    size_t replacement_len;
+    bool global;
+
+    // result, amount of replaced occurrences
+    size_t replaced;
+} Substitution;
+
+// A position inside of the buffer while a motion (e.g. 'w') is scanning it.
+// 'c' is the character at 'x' (starting at byte 'offset' and being 'len'
+// bytes long) or WEOF if 'x' is at the end of the line.
+typedef struct _Motion_ {
+    size_t y;
+    Line *lin;
+    wint_t c;
+    size_t len;
+    size_t offset;
+    size_t x;
+    size_t render_x;
+} Motion;
+
+// A block of a mapped file (see Buffer). The pages of a block are loaded
+// from the file when a line inside of it is accessed, the blocks that have
+// been used most recently stay in memory. Any other block is handed back to
+// the kernel, a later access just loads it again.
+typedef struct _BufferBlock_ {
+    // neighbours in the list of used blocks, most recently used first
+    size_t prev;
+    size_t next;
+    bool used;
+} BufferBlock;
+
+// A mapped file, registered for the SIGBUS handler (see buffer_map_fault).
+// Accessing a page behind the end of a file that has been truncated raises
+// SIGBUS, the handler replaces the page with zeros and sets 'lost'. Every
+// field is accessed atomically, 'start' is 0 while the slot is not used.
+typedef struct _BufferMapping_ {
+    uintptr_t start;
+    size_t len;
+    bool used;
+    bool lost;
+} BufferMapping;
+
+// One or more lines of a save, written followed by a \n. Lines that still
+// point into 'file_data' are never changed, they are written from there and
+// consecutive lines of the file end up in a single segment. Any other line
+// is a segment of its own, its content is shared with the save until the
+// line is edited (see line_reserve).
+typedef struct _SaveSegment_ {
+    const char *data;
+    size_t bytes;
+    // the save holds a reference to 'data', which is released once it has
+    // been written
+    bool shared;
+} SaveSegment;
+
+// A snapshot of the buffer that is being written to a file, editing the
+// buffer meanwhile does not change it (see buffer_save_start)
+typedef struct _BufferSave_ {
+    // The snapshot is taken on the thread of the save by walking the
+    // 'lines' lines from 'first', 'walked' is set once it is complete. The
+    // buffer must not be changed before, see buffer_save_wait_walk.
+    Line *first;
+    size_t lines;
+    bool walked;
+    pthread_mutex_t lock;
+    pthread_cond_t walked_cond;
+    SaveSegment *segments;
+    size_t segment_count;
+
+    FILE *fp;
+    // 'fp' is a temporary file at 'tmp_path' that replaces the file at
+    // 'target' once it is written, both are NULL if 'fp' is the file itself
+    char *target;
+    char *tmp_path;
+    // the mapped file of the buffer (see BufferBlock), the writer releases
+    // the pages it is done with. The save fails if the file is truncated
+    // meanwhile, 'map_fd', 'map_size' and 'map_slot' tell.
+    const char *map;
+    size_t page_size;
+    int map_fd;
+    size_t map_size;
+    size_t map_slot;
+
+    // 'written' of 'total' bytes, 'done' is set once the file is complete,
+    // both are accessed atomically
+    size_t total;
+    size_t written;
+    bool done;
+    bool ok;
+
+    // false if the save is running on the thread that started it
+    bool threaded;
+    pthread_t thread;
+} BufferSave;
+
+enum BufferSaveStatus {
+    BUFFER_SAVE_NONE,    // there is no save
+    BUFFER_SAVE_RUNNING, // still writing
+    BUFFER_SAVE_DONE,    // the file has been saved
+    BUFFER_SAVE_FAILED   // the file could not be saved
+};
+
+// An additional cursor, see Buffer
+typedef struct _Cursor_ {
+    size_t x;
+    size_t y;
+} Cursor;
+
 typedef struct _Buffer_ {
     char *file_path;
     FILE *fp;
@@ -36,32 +178,640 @@ typedef struct _Buffer_ {
     // of character width on unicode characters
     size_t render_cursor_x;
 
-    size_t cursor_max;
+    // Index of the first line on the screen
     size_t scroll_y;
 
+    // Additional cursors for editing multiple places at once, sorted by
+    // position (line first). The cursor above is the primary one, it is
+    // never part of this list. 'cursor_cap' cursors fit in without growing.
+    Cursor *cursors;
+    size_t cursor_count;
+    size_t cursor_cap;
+
     State *state;
 
+    // Follow mode, the file is being watched for appended content
+    bool follow;
+    int watch_fd;
+    // Amount of bytes of the file that are already stored inside of the
+    // buffer as complete lines, reading appended content starts here.
+    // 'read_partial' bytes after it are not terminated by a \n yet, they are
+    // the last line, which is replaced once the rest of it is appended.
+    off_t read_offset;
+    size_t read_partial;
+
+    // The whole file as it has been read, see Line. Files larger than
+    // State.max_mem are mapped read-only instead, 'blocks' is NULL otherwise.
+    // Only the blocks in the list from 'block_first' to 'block_last' are
+    // kept in memory, 'block_used' blocks are in it.
+    char *file_data;
+    size_t file_size;
+    BufferBlock *blocks;
+    size_t block_count;
+    size_t block_first;
+    size_t block_last;
+    size_t block_used;
+    // The mapped file stays open as 'map_fd' to notice when it is truncated,
+    // the mapping is registered in slot 'map_slot' (see BufferMapping).
+    // 'map_lost' is set once the lines behind the new end of the file read
+    // as zeros, the buffer can't be saved anymore.
+    int map_fd;
+    size_t map_slot;
+    bool map_lost;
+
+    // The save that is running on a background thread, NULL if there is
+    // none
+    BufferSave *save;
+
     size_t size;
     Line *lines;
     Line *first_line;
     Line *last_line;
+
+    // Every line of the buffer in order, allows to find a line in constant
+    // time instead of walking the list. 'size' lines are stored,
+    // 'line_index_cap' lines fit in without growing it.
+    Line **line_index;
+    size_t line_index_cap;
 } Buffer;
 
-// All static methods are for internal purposes and not exposed to the one
-// including buffer.h
+// All static methods are for internal purposes and not exposed to the one
+// including buffer.h
+
+/**
+ *  buffer_init_empty(buf, path)
+ *
+ *  Purpose:
+ *      This function inits the specified buffer with
+ *      one empty line. Note that this function is using
+ *      printf to print an error if occoured.
+ *  Return value:
+ *      true - Init was successful
+ *      false - Init failed
+ */
+static bool buffer_init_empty(Buffer *buf, char *path);
+
+/**
+ *  line_new_from_bytes(bytes, len)
+ *
+ *  Purpose:
+ *      This function allocates a new line holding a copy of the first 'len'
+ *      bytes of the UTF-8 string 'bytes'.
+ *  Return value:
+ *      NULL - Allocation failed
+ *      Line* - the newly allocated line
+ */
+static Line *line_new_from_bytes(const char *bytes, size_t len);
+
+/**
+ *  line_free(lin)
+ *
+ *  Purpose:
+ *      This function free's the line 'lin' and its content.
+ *  Return value:
+ *      void
+ */
+static void line_free(Line *lin);
+
+/**
+ *  line_release(data)
+ *
+ *  Purpose:
+ *      This function drops a reference to the content 'data' of a line and
+ *      frees it with the last one, it may be called by any thread.
+ *  Return value:
+ *      void
+ */
+static void line_release(char *data);
+
+/**
+ *  line_reserve(lin, bytes)
+ *
+ *  Purpose:
+ *      This function makes sure that the line 'lin' owns its content and
+ *      that at least 'bytes' bytes fit into it. Content that is still
+ *      shared with the buffer's 'file_data' or with a running save is
+ *      copied.
+ *  Return value:
+ *      true - The line can be modified
+ *      false - Allocation failed, the line is left unchanged
+ */
+static bool line_reserve(Line *lin, size_t bytes);
+
+/**
+ *  line_count_around(data, bytes, start, end)
+ *
+ *  Purpose:
+ *      This function counts the characters of the 'bytes' bytes at 'data'
+ *      from a few characters in front of 'start' up to a few bytes behind
+ *      'end'. Removing the bytes between 'start' and 'end' may join invalid
+ *      bytes in front of and behind them into a single character, the
+ *      difference between the count before and after removing them is the
+ *      change of 'Line.size'. 'start' needs to be the start of a character.
+ *  Return value:
+ *      size_t - amount of characters around 'start' and 'end'
+ */
+static size_t line_count_around(const char *data, size_t bytes, size_t start,
+                                size_t end);
+
+/**
+ *  buffer_index_insert(buf, index, lin)
+ *
+ *  Purpose:
+ *      This function inserts the line 'lin' into the buffer's line index
+ *      at 'index' and updates the buffer's size. The linked list of lines
+ *      is not being touched.
+ *  Return value:
+ *      true - Insertion successful
+ *      false - The index could not be grown
+ */
+static bool buffer_index_insert(Buffer *buf, size_t index, Line *lin);
+
+/**
+ *  buffer_index_reserve(buf, size)
+ *
+ *  Purpose:
+ *      This function grows the buffer's line index so that 'size' lines
+ *      fit into it.
+ *  Return value:
+ *      true - The index is large enough
+ *      false - The index could not be grown
+ */
+static bool buffer_index_reserve(Buffer *buf, size_t size);
+
+/**
+ *  buffer_index_remove(buf, index)
+ *
+ *  Purpose:
+ *      This function removes the line at 'index' from the buffer's line
+ *      index and updates the buffer's size. The linked list of lines is
+ *      not being touched.
+ *  Return value:
+ *      void
+ */
+static void buffer_index_remove(Buffer *buf, size_t index);
+
+/**
+ *  buffer_push_line(buf, lin)
+ *
+ *  Purpose:
+ *      This function appends the line 'lin' to the end of the buffer.
+ *  Return value:
+ *      true - Appending was successful
+ *      false - The line index could not be grown
+ */
+static bool buffer_push_line(Buffer *buf, Line *lin);
+
+/**
+ *  buffer_push_bytes(buf, bytes, len)
+ *
+ *  Purpose:
+ *      This function copies 'len' bytes of UTF-8 from 'bytes' (one line
+ *      without the trailing \n) into a new line at the end of the buffer.
+ *  Return value:
+ *      true - Appending was successful
+ *      false - Allocation failed
+ */
+static bool buffer_push_bytes(Buffer *buf, const char *bytes, size_t len);
+
+/**
+ *  buffer_follow_line(buf, bytes, len)
+ *
+ *  Purpose:
+ *      This function adds a line read from the followed file. If it starts
+ *      with the unterminated last line (see 'read_partial') and that line
+ *      has not been edited, the last line is replaced instead of appending
+ *      a new one.
+ *  Return value:
+ *      true - The line has been added
+ *      false - Allocation failed
+ */
+static bool buffer_follow_line(Buffer *buf, const char *bytes, size_t len);
+
+/**
+ *  buffer_set_cursor_x(buf, lin, cursor_x)
+ *
+ *  Purpose:
+ *      This function moves the cursor to 'cursor_x' inside of the line
+ *      'lin' and recomputes 'render_cursor_x'.
+ *  Return value:
+ *      void
+ */
+static void buffer_set_cursor_x(Buffer *buf, Line *lin, size_t cursor_x);
+
+/**
+ *  character_class(c)
+ *
+ *  Purpose:
+ *      This function groups characters for word motions. Words are made of
+ *      either keyword characters (letters, digits and '_') or of other
+ *      non-blank characters.
+ *  Return value:
+ *      0 - 'c' is whitespace
+ *      1 - 'c' is punctuation
+ *      2 - 'c' is a keyword character
+ */
+static int character_class(wint_t c);
+
+/**
+ *  motion_start(buf, m)
+ *
+ *  Purpose:
+ *      This function initializes the motion 'm' at the buffer's cursor.
+ *  Return value:
+ *      true - 'm' is at the cursor
+ *      false - The cursor's line could not be found
+ */
+static bool motion_start(Buffer *buf, Motion *m);
+
+/**
+ *  motion_decode(m)
+ *
+ *  Purpose:
+ *      This function updates the character 'c' and its length 'len' of 'm'
+ *      from the byte 'offset' of its line.
+ *  Return value:
+ *      void
+ */
+static void motion_decode(Motion *m);
+
+/**
+ *  motion_next(m)
+ *
+ *  Purpose:
+ *      This function moves 'm' one character to the right, at most to the
+ *      end of the line.
+ *  Return value:
+ *      true - 'm' moved
+ *      false - 'm' already was at the end of the line
+ */
+static bool motion_next(Motion *m);
+
+/**
+ *  motion_prev(m)
+ *
+ *  Purpose:
+ *      This function moves 'm' one character to the left.
+ *  Return value:
+ *      true - 'm' moved
+ *      false - 'm' already was at the start of the line
+ */
+static bool motion_prev(Motion *m);
+
+/**
+ *  motion_forward(buf, m)
+ *
+ *  Purpose:
+ *      Works like motion_next but continues at the start of the next line
+ *      once the end of a line is reached.
+ *  Return value:
+ *      true - 'm' moved
+ *      false - 'm' already was at the end of the buffer
+ */
+static bool motion_forward(Buffer *buf, Motion *m);
+
+/**
+ *  motion_backward(m)
+ *
+ *  Purpose:
+ *      Works like motion_prev but continues at the end of the previous
+ *      line once the start of a line is reached.
+ *  Return value:
+ *      true - 'm' moved
+ *      false - 'm' already was at the start of the buffer
+ */
+static bool motion_backward(Motion *m);
+
+/**
+ *  buffer_apply_motion(buf, m)
+ *
+ *  Purpose:
+ *      This function moves the buffer's cursor to the position of 'm'.
+ *      Positions at the end of a non-empty line are moved onto its last
+ *      character.
+ *  Return value:
+ *      void
+ */
+static void buffer_apply_motion(Buffer *buf, Motion *m);
+
+/**
+ *  line_offsets(lin, indexes, count)
+ *
+ *  Purpose:
+ *      This function replaces the 'count' ascending character indexes in
+ *      'indexes' by the byte offsets of those characters inside of 'lin',
+ *      walking the line only once. Indexes behind the end of the line
+ *      become 'lin->bytes'.
+ *  Return value:
+ *      void
+ */
+static void line_offsets(Line *lin, size_t *indexes, size_t count);
+
+/**
+ *  line_delete_chars(lin, offsets, count)
+ *
+ *  Purpose:
+ *      This function deletes the characters starting at the 'count'
+ *      ascending byte 'offsets' from 'lin' in a single pass.
+ *  Return value:
+ *      void
+ */
+static void line_delete_chars(Line *lin, const size_t *offsets, size_t count);
+
+/**
+ *  cursor_compare(a, b)
+ *
+ *  Purpose:
+ *      This function compares the positions of the cursors 'a' and 'b'.
+ *  Return value:
+ *      int - less than, equal to or greater than 0 if 'a' is before, at or
+ *            behind 'b'
+ */
+static int cursor_compare(const Cursor *a, const Cursor *b);
+
+/**
+ *  buffer_cursors_reserve(buf, count)
+ *
+ *  Purpose:
+ *      This function grows the list of cursors so that 'count' cursors fit
+ *      into it.
+ *  Return value:
+ *      true - The list is large enough
+ *      false - The list could not be grown
+ */
+static bool buffer_cursors_reserve(Buffer *buf, size_t count);
+
+/**
+ *  buffer_cursors_begin(buf)
+ *
+ *  Purpose:
+ *      This function prepares an edit at every cursor: the primary cursor
+ *      is inserted into the sorted list of cursors, cursors outside of the
+ *      buffer are moved onto its content and duplicates are merged.
+ *  Return value:
+ *      size_t - index of the primary cursor inside of the list, or
+ *               'buf->cursor_count' if the list could not be grown
+ */
+static size_t buffer_cursors_begin(Buffer *buf);
+
+/**
+ *  buffer_cursors_end(buf, primary)
+ *
+ *  Purpose:
+ *      This function finishes an edit started by buffer_cursors_begin. The
+ *      cursor at index 'primary' becomes the primary cursor again and
+ *      cursors that ended up at the same position are merged.
+ *  Return value:
+ *      void
+ */
+static void buffer_cursors_end(Buffer *buf, size_t primary);
+
+/**
+ *  buffer_cursors_merge(buf, primary)
+ *
+ *  Purpose:
+ *      This function removes cursors that are at the same position as the
+ *      one before them from the sorted list of cursors.
+ *  Return value:
+ *      size_t - the new index of the cursor that was at index 'primary'
+ */
+static size_t buffer_cursors_merge(Buffer *buf, size_t primary);
+
+/**
+ *  line_substitute(lin, sub, scratch, scratch_cap)
+ *
+ *  Purpose:
+ *      This function replaces the first (or every if 'global' is set)
+ *      occurrence of the pattern of 'sub' inside of the line 'lin'.
+ *      The new content is built inside of '*scratch', which is grown if
+ *      needed, and copied into the line at once.
+ *  Return value:
+ *      size_t - amount of replaced occurrences
+ */
+static size_t line_substitute(Line *lin, const Substitution *sub,
+                              char **scratch, size_t *scratch_cap);
+
+/**
+ *  buffer_substitute_worker(arg)
+ *
+ *  Purpose:
+ *      Thread entry point of buffer_substitute, 'arg' is a Substitution
+ *      describing the range of lines to work on.
+ *  Return value:
+ *      NULL
+ */
+static void *buffer_substitute_worker(void *arg);
+
+/**
+ *  buffer_map_fault(sig, info, context)
+ *
+ *  Purpose:
+ *      This function handles SIGBUS. A fault inside of a registered mapping
+ *      (see BufferMapping) hit a page behind the end of a truncated file,
+ *      the page is replaced with zeros and the access is repeated. Any
+ *      other SIGBUS is raised again without the handler.
+ *  Return value:
+ *      void
+ */
+static void buffer_map_fault(int sig, siginfo_t *info, void *context);
+
+/**
+ *  buffer_map_install()
+ *
+ *  Purpose:
+ *      This function installs buffer_map_fault as the SIGBUS handler, it is
+ *      called once before the first file is mapped.
+ *  Return value:
+ *      void
+ */
+static void buffer_map_install(void);
+
+/**
+ *  buffer_map_register(data, size)
+ *
+ *  Purpose:
+ *      This function registers the mapping of 'size' bytes at 'data' for
+ *      the SIGBUS handler.
+ *  Return value:
+ *      The slot of the mapping, BUFFER_MAPPINGS_MAX if every slot is used
+ */
+static size_t buffer_map_register(char *data, size_t size);
+
+/**
+ *  buffer_map_unregister(slot)
+ *
+ *  Purpose:
+ *      This function hands the slot of a mapping back before it is
+ *      unmapped.
+ *  Return value:
+ *      void
+ */
+static void buffer_map_unregister(size_t slot);
+
+/**
+ *  buffer_map_check(buf)
+ *
+ *  Purpose:
+ *      This function checks whether the mapped file of 'buf' has been
+ *      truncated. Everything behind its new end is replaced with zeros
+ *      before it is accessed and 'map_lost' is set.
+ *  Return value:
+ *      true - Lines of the buffer have been lost
+ *      false - The mapping is intact or 'buf' is not mapped
+ */
+static bool buffer_map_check(Buffer *buf);
+
+/**
+ *  buffer_drop_lines(buf)
+ *
+ *  Purpose:
+ *      This function frees every line of 'buf' and the file they point
+ *      into, whether it is mapped or not. 'buf' is left without a single
+ *      line.
+ *  Return value:
+ *      void
+ */
+static void buffer_drop_lines(Buffer *buf);
+
+/**
+ *  buffer_map_file(buf, size)
+ *
+ *  Purpose:
+ *      This function maps the first 'size' bytes of the file 'buf->fp'
+ *      into 'file_data' and divides them into blocks.
+ *  Return value:
+ *      true - The file is mapped
+ *      false - Mapping failed, the file can't be opened
+ */
+static bool buffer_map_file(Buffer *buf, size_t size);
+
+/**
+ *  buffer_blocks_release(buf, first, count)
+ *
+ *  Purpose:
+ *      This function hands the memory of 'count' blocks starting at block
+ *      'first' back to the kernel, without removing them from the list of
+ *      used blocks.
+ *  Return value:
+ *      void
+ */
+static void buffer_blocks_release(Buffer *buf, size_t first, size_t count);
+
+/**
+ *  buffer_block_touch(buf, index)
+ *
+ *  Purpose:
+ *      This function moves the block 'index' to the front of the list of
+ *      used blocks. The least recently used block is released if the list
+ *      would grow beyond State.max_mem.
+ *  Return value:
+ *      void
+ */
+static void buffer_block_touch(Buffer *buf, size_t index);
+
+/**
+ *  buffer_save_push(save, lin)
+ *
+ *  Purpose:
+ *      This function adds the line 'lin' to the snapshot 'save', the
+ *      content of an edited line is shared with it. There needs to be room
+ *      for another segment.
+ *  Return value:
+ *      void
+ */
+static void buffer_save_push(BufferSave *save, Line *lin);
+
+/**
+ *  buffer_save_walk(save)
+ *
+ *  Purpose:
+ *      This function takes the snapshot 'save' by walking the lines of the
+ *      buffer and signals buffer_save_wait_walk once it is done.
+ *  Return value:
+ *      true - The snapshot is complete
+ *      false - Allocation failed, the snapshot is empty
+ */
+static bool buffer_save_walk(BufferSave *save);
+
+/**
+ *  buffer_save_wait_walk(buf)
+ *
+ *  Purpose:
+ *      This function waits until the running save of 'buf' has taken its
+ *      snapshot, every function that changes the lines calls it first.
+ *  Return value:
+ *      void
+ */
+static void buffer_save_wait_walk(Buffer *buf);
+
+/**
+ *  buffer_save_open(buf, save, path)
+ *
+ *  Purpose:
+ *      This function opens the file the snapshot 'save' is written to,
+ *      without truncating it. The old content is overwritten and cut off
+ *      by buffer_save_worker. A mapped buffer is written to a new file next
+ *      to the one at 'path' instead, which replaces it once it is complete.
+ *      The mapped file itself is never written, the lines still point into
+ *      it.
+ *  Return value:
+ *      true - 'save->fp' is open
+ *      false - The file could not be created
+ */
+static bool buffer_save_open(Buffer *buf, BufferSave *save, char *path);
+
+/**
+ *  buffer_save_prepare(buf, path)
+ *
+ *  Purpose:
+ *      This function opens the file at 'path' for a snapshot of 'buf',
+ *      which is stored in 'buf->save'. The snapshot itself is taken by
+ *      buffer_save_worker.
+ *  Return value:
+ *      true - The snapshot is ready to be written
+ *      false - A save is running already, lines of the mapped file have
+ *              been lost (see 'map_lost') or preparing it failed
+ */
+static bool buffer_save_prepare(Buffer *buf, char *path);
+
+/**
+ *  buffer_save_write(save, data, len, mapped)
+ *
+ *  Purpose:
+ *      This function writes 'len' bytes at 'data' to the file of 'save' and
+ *      adds them to its progress. If 'mapped' is set, 'data' points into
+ *      the mapped file, whose pages are released once they are written.
+ *  Return value:
+ *      true - The bytes have been written
+ *      false - Writing failed
+ */
+static bool buffer_save_write(BufferSave *save, const char *data, size_t len,
+                              bool mapped);
+
+/**
+ *  buffer_save_worker(arg)
+ *
+ *  Purpose:
+ *      This function takes the snapshot 'arg' (a BufferSave), writes it
+ *      and closes the file, it runs on its own thread.
+ *  Return value:
+ *      void* - always NULL
+ */
+static void *buffer_save_worker(void *arg);
 
 /**
- *  buffer_init_empty(buf, path)
+ *  buffer_save_free(save)
  *
  *  Purpose:
- *      This function inits the specified buffer with
- *      one empty line. Note that this function is using
- *      printf to print an error if occoured.
+ *      This function free's the snapshot 'save' and closes its file if it
+ *      is still open. The temporary file of a mapped buffer is removed
+ *      then, the file it should replace stays as it is. Any other file is
+ *      written in place, a save that has been interrupted or has failed
+ *      leaves it partially overwritten.
  *  Return value:
- *      true - Init was successful
- *      false - Init failed
+ *      void
  */
-static bool buffer_init_empty(Buffer *buf, char *path);
+static void buffer_save_free(BufferSave *save);
 
 /**
  *  buffer_read_from_file(buf, path)
@@ -93,7 +843,8 @@ void buffer_free(Buffer *buf);
  *
  *  Purpose:
  *      This function writes the content of the specified buffer
- *      to the file being specified by 'path'.
+ *      to the file being specified by 'path' and returns once it is
+ *      written, see buffer_save_start for saving in the background.
  *      Note that this function is not using printf to
  *      print an error if occoured.
  *  Return value:
@@ -102,6 +853,71 @@ void buffer_free(Buffer *buf);
  */
 bool buffer_save(Buffer *buf, char *path);
 
+/**
+ *  buffer_touch_line(buf, lin)
+ *
+ *  Purpose:
+ *      This function marks the blocks holding the text of 'lin' as
+ *      recently used, if the line still points into the mapped file.
+ *      buffer_find_line does so for every line it returns.
+ *  Return value:
+ *      void
+ */
+void buffer_touch_line(Buffer *buf, Line *lin);
+
+/**
+ *  buffer_trim(buf)
+ *
+ *  Purpose:
+ *      This function releases every block of a mapped file that is not in
+ *      the list of used blocks. It is called after the whole buffer has
+ *      been looked at (e.g. by buffer_substitute), which loaded every
+ *      block of the file.
+ *  Return value:
+ *      void
+ */
+void buffer_trim(Buffer *buf);
+
+/**
+ *  buffer_save_start(buf, path)
+ *
+ *  Purpose:
+ *      This function takes a snapshot of the buffer and writes it to the
+ *      file at 'path' on a background thread, the buffer can be edited
+ *      once the snapshot is taken. No line is copied for it, edited lines
+ *      are copied by the next edit instead. buffer_save_finish needs to be
+ *      called until the save is done.
+ *  Return value:
+ *      true - The save is running
+ *      false - A save is running already, lines of the mapped file have
+ *              been lost or the file can't be written
+ */
+bool buffer_save_start(Buffer *buf, char *path);
+
+/**
+ *  buffer_save_progress(buf)
+ *
+ *  Purpose:
+ *      This function looks up how much of the running save of 'buf' has
+ *      been written.
+ *  Return value:
+ *      size_t - percentage between 0 and 100, 0 if there is no save
+ */
+size_t buffer_save_progress(Buffer *buf);
+
+/**
+ *  buffer_save_finish(buf, wait)
+ *
+ *  Purpose:
+ *      This function cleans up the save of 'buf' once it is done. If
+ *      'wait' is set, the save is waited for.
+ *  Return value:
+ *      enum BufferSaveStatus - BUFFER_SAVE_RUNNING if the save is not done
+ *                              yet (only without 'wait'), the result of
+ *                              the save otherwise
+ */
+enum BufferSaveStatus buffer_save_finish(Buffer *buf, bool wait);
+
 /**
  *  buffer_append_at_cursor(buf, c)
  *
@@ -119,7 +935,7 @@ void buffer_append_char_at_cursor(Buffer *buf, wint_t c);
  *
  *  Purpose:
  *      This function finds a line inside of the provided buffer
- *      given it's index.
+ *      given it's index. This takes constant time.
  *  Return value:
  *      NULL - the line could not be found
  *      Line* - the line at the specified index
@@ -127,16 +943,29 @@ void buffer_append_char_at_cursor(Buffer *buf, wint_t c);
 Line *buffer_find_line(Buffer *buf, size_t index);
 
 /**
- *  line_find_char(buf, lin, index)
+ *  line_offset(lin, index)
+ *
+ *  Purpose:
+ *      This function finds the byte offset of the character at 'index'
+ *      inside of the line 'lin'. Lines without multibyte characters are
+ *      not scanned.
+ *  Return value:
+ *      size_t - offset of the character, 'bytes' if 'index' is out of
+ *               bounds
+ */
+size_t line_offset(Line *lin, size_t index);
+
+/**
+ *  line_char_at(lin, index)
  *
  *  Purpose:
- *      This function finds a character inside of the specified
- *      line 'lin' at the given index.
+ *      This function decodes the character at 'index' inside of the line
+ *      'lin'.
  *  Return value:
- *      NULL - the char could not be found
- *      Character* - the char at the specified index
+ *      WEOF - 'index' is out of bounds
+ *      wint_t - the character at the specified index
  */
-Character *line_find_char(Buffer *buf, Line *lin, size_t index);
+wint_t line_char_at(Line *lin, size_t index);
 
 /**
  *  buffer_move_cursor_down(buf)
@@ -282,4 +1111,367 @@ bool buffer_move_render_cursor_x(Buffer *buf, size_t cursor_x, int direction_x);
  */
 bool buffer_move_render_cursor(Buffer *buf, int direction_x);
 
+/**
+ *  buffer_follow_start(buf)
+ *
+ *  Purpose:
+ *      This function starts watching the buffer's file for appended
+ *      content (follow mode). Content that has been appended since the
+ *      file was read is loaded right away.
+ *  Return value:
+ *      true - The buffer is now following its file
+ *      false - Watching the file failed or is not supported
+ */
+bool buffer_follow_start(Buffer *buf);
+
+/**
+ *  buffer_follow_stop(buf)
+ *
+ *  Purpose:
+ *      This function stops following the buffer's file.
+ *  Return value:
+ *      void
+ */
+void buffer_follow_stop(Buffer *buf);
+
+/**
+ *  buffer_follow_update(buf)
+ *
+ *  Purpose:
+ *      This function should be called once 'watch_fd' is readable.
+ *      Only the bytes appended after 'read_offset' are read and appended
+ *      to the buffer as new lines. A line that is not terminated by a \n
+ *      yet is shown as the last line and completed by the next update. If
+ *      the cursor was on the last line, it is moved to the new last line.
+ *      Once a mapped file has been truncated, its lines are dropped and the
+ *      buffer starts over with the new content.
+ *  Return value:
+ *      true - New lines have been appended
+ *      false - Nothing changed or reading failed
+ */
+bool buffer_follow_update(Buffer *buf);
+
+/**
+ *  character_width(c)
+ *
+ *  Purpose:
+ *      This function returns the amount of columns the character 'c'
+ *      takes up on the screen. Unlike wcwidth, non-printable characters
+ *      take up one column.
+ *  Return value:
+ *      int - width of 'c'
+ */
+int character_width(wint_t c);
+
+/**
+ *  line_wrap(lin, width)
+ *
+ *  Purpose:
+ *      This function computes the soft wrap positions of the line 'lin'
+ *      for a window that is 'width' columns wide. The positions are cached
+ *      inside of the line and are only recomputed if the line has been
+ *      edited or 'width' changed.
+ *  Return value:
+ *      size_t - amount of visual rows the line takes up
+ */
+size_t line_wrap(Line *lin, size_t width);
+
+/**
+ *  line_wrap_row(lin, index)
+ *
+ *  Purpose:
+ *      This function finds the visual row that the character at 'index'
+ *      is displayed in. line_wrap needs to be called first.
+ *  Return value:
+ *      size_t - the visual row, starting at 0
+ */
+size_t line_wrap_row(Line *lin, size_t index);
+
+/**
+ *  buffer_move_cursor_row_down(buf, width)
+ *
+ *  Purpose:
+ *      Works like buffer_move_cursor_down but moves by one visual row of
+ *      a line that is soft wrapped at 'width' columns.
+ *  Return value:
+ *      void
+ */
+void buffer_move_cursor_row_down(Buffer *buf, size_t width);
+
+/**
+ *  buffer_move_cursor_row_up(buf, width)
+ *
+ *  Purpose:
+ *      Works like buffer_move_cursor_up but moves by one visual row of
+ *      a line that is soft wrapped at 'width' columns.
+ *  Return value:
+ *      void
+ */
+void buffer_move_cursor_row_up(Buffer *buf, size_t width);
+
+/**
+ *  buffer_scroll_wrapped(buf, width)
+ *
+ *  Purpose:
+ *      This function updates 'scroll_y' so that the cursor is visible
+ *      while lines are soft wrapped at 'width' columns. Only the lines
+ *      between 'scroll_y' and the cursor are looked at.
+ *  Return value:
+ *      void
+ */
+void buffer_scroll_wrapped(Buffer *buf, size_t width);
+
+/**
+ *  buffer_move_cursor_to_line(buf, index)
+ *
+ *  Purpose:
+ *      This function moves the cursor to the start of the line at 'index'.
+ *      If 'index' is out of bounds, the cursor is moved to the last line.
+ *  Return value:
+ *      void
+ */
+void buffer_move_cursor_to_line(Buffer *buf, size_t index);
+
+/**
+ *  buffer_scroll_to_cursor(buf)
+ *
+ *  Purpose:
+ *      This function computes 'scroll_y' from the cursor's position so that
+ *      the cursor is on the screen. The screen only moves if the cursor
+ *      would not be visible otherwise.
+ *  Return value:
+ *      void
+ */
+void buffer_scroll_to_cursor(Buffer *buf);
+
+/**
+ *  buffer_scroll_down(buf, lines)
+ *
+ *  Purpose:
+ *      This function scrolls the screen down by 'lines' lines, at most
+ *      until the last line is at the bottom of the screen. The cursor is
+ *      moved to the top of the screen if it would not be visible anymore.
+ *  Return value:
+ *      void
+ */
+void buffer_scroll_down(Buffer *buf, size_t lines);
+
+/**
+ *  buffer_scroll_up(buf, lines)
+ *
+ *  Purpose:
+ *      This function scrolls the screen up by 'lines' lines. The cursor is
+ *      moved to the bottom of the screen if it would not be visible
+ *      anymore.
+ *  Return value:
+ *      void
+ */
+void buffer_scroll_up(Buffer *buf, size_t lines);
+
+/**
+ *  buffer_move_cursor_word_next(buf)
+ *
+ *  Purpose:
+ *      This function moves the cursor to the start of the next word,
+ *      continuing on the following lines if needed (vim's 'w').
+ *  Return value:
+ *      void
+ */
+void buffer_move_cursor_word_next(Buffer *buf);
+
+/**
+ *  buffer_move_cursor_word_prev(buf)
+ *
+ *  Purpose:
+ *      This function moves the cursor to the start of the previous word,
+ *      continuing on the preceding lines if needed (vim's 'b').
+ *  Return value:
+ *      void
+ */
+void buffer_move_cursor_word_prev(Buffer *buf);
+
+/**
+ *  buffer_move_cursor_word_end(buf)
+ *
+ *  Purpose:
+ *      This function moves the cursor to the end of the next word,
+ *      continuing on the following lines if needed (vim's 'e').
+ *  Return value:
+ *      void
+ */
+void buffer_move_cursor_word_end(Buffer *buf);
+
+/**
+ *  buffer_move_cursor_find_char(buf, c)
+ *
+ *  Purpose:
+ *      This function moves the cursor to the next occurrence of 'c'
+ *      to the right of the cursor inside of the current line (vim's 'f').
+ *  Return value:
+ *      true - 'c' was found and the cursor moved
+ *      false - 'c' is not in the rest of the line
+ */
+bool buffer_move_cursor_find_char(Buffer *buf, wint_t c);
+
+/**
+ *  buffer_move_cursor_line_start(buf)
+ *
+ *  Purpose:
+ *      This function moves the cursor to the first character of the
+ *      current line (vim's '0').
+ *  Return value:
+ *      void
+ */
+void buffer_move_cursor_line_start(Buffer *buf);
+
+/**
+ *  buffer_move_cursor_line_end(buf)
+ *
+ *  Purpose:
+ *      This function moves the cursor to the last character of the
+ *      current line (vim's '$').
+ *  Return value:
+ *      void
+ */
+void buffer_move_cursor_line_end(Buffer *buf);
+
+/**
+ *  buffer_clamp_cursor(buf)
+ *
+ *  Purpose:
+ *      This function moves the cursor back onto the last line or the last
+ *      character of its line if they have been deleted without moving it
+ *      (e.g. through another view of the buffer). Only then the column the
+ *      cursor is drawn at is computed again from its line, a cursor that is
+ *      still in range is left as it is.
+ *  Return value:
+ *      void
+ */
+void buffer_clamp_cursor(Buffer *buf);
+
+/**
+ *  buffer_substitute(buf, first, last, pattern, replacement, global)
+ *
+ *  Purpose:
+ *      This function replaces the first (or every if 'global' is set)
+ *      occurrence of 'pattern' by 'replacement' on every line from 'first'
+ *      to 'last' (inclusive). The pattern is matched literally. Every line
+ *      is scanned once and only rewritten if it contains the pattern,
+ *      large ranges are split across threads.
+ *  Return value:
+ *      size_t - amount of replaced occurrences
+ */
+size_t buffer_substitute(Buffer *buf, size_t first, size_t last,
+                         const wchar_t *pattern, const wchar_t *replacement,
+                         bool global);
+
+/**
+ *  buffer_add_cursor(buf, cursor_x, cursor_y)
+ *
+ *  Purpose:
+ *      This function adds an additional cursor at 'cursor_x' inside of the
+ *      line 'cursor_y'. Nothing happens if there already is a cursor.
+ *  Return value:
+ *      true - There is a cursor at that position now
+ *      false - The position is invalid or allocation failed
+ */
+bool buffer_add_cursor(Buffer *buf, size_t cursor_x, size_t cursor_y);
+
+/**
+ *  buffer_add_cursor_lines(buf, first, last)
+ *
+ *  Purpose:
+ *      This function adds a cursor to every line from 'first' to 'last'
+ *      (inclusive) in the column of the primary cursor, or on the last
+ *      character of lines that are shorter.
+ *  Return value:
+ *      size_t - amount of cursors that have been added
+ */
+size_t buffer_add_cursor_lines(Buffer *buf, size_t first, size_t last);
+
+/**
+ *  buffer_add_cursor_next_match(buf)
+ *
+ *  Purpose:
+ *      This function adds a cursor to the next occurrence of the word
+ *      under the primary cursor behind the last cursor, wrapping around
+ *      at the end of the buffer. The new cursor is placed on the same
+ *      character of the word as the primary cursor.
+ *  Return value:
+ *      true - A cursor has been added
+ *      false - There is no other occurrence without a cursor
+ */
+bool buffer_add_cursor_next_match(Buffer *buf);
+
+/**
+ *  buffer_find_cursor(buf, cursor_x, cursor_y)
+ *
+ *  Purpose:
+ *      This function looks up the first additional cursor at or behind
+ *      'cursor_x' inside of the line 'cursor_y' with a binary search.
+ *  Return value:
+ *      size_t - index into 'buf->cursors', 'buf->cursor_count' if there is
+ *               none
+ */
+size_t buffer_find_cursor(Buffer *buf, size_t cursor_x, size_t cursor_y);
+
+/**
+ *  buffer_clear_cursors(buf)
+ *
+ *  Purpose:
+ *      This function removes every additional cursor.
+ *  Return value:
+ *      void
+ */
+void buffer_clear_cursors(Buffer *buf);
+
+/**
+ *  buffer_cursors_append_char(buf, c)
+ *
+ *  Purpose:
+ *      This function does what buffer_append_char_at_cursor does at every
+ *      cursor. All cursors are handled in one pass over the buffer sorted
+ *      by position: every line is grown and shifted once, no matter how
+ *      many cursors it has, and the cursors behind an insertion are moved
+ *      by the amount of characters inserted in front of them.
+ *  Return value:
+ *      void
+ */
+void buffer_cursors_append_char(Buffer *buf, wint_t c);
+
+/**
+ *  buffer_cursors_delete_char(buf)
+ *
+ *  Purpose:
+ *      This function deletes the character at every cursor in one pass,
+ *      see buffer_cursors_append_char and buffer_delete_char_at_cursor.
+ *  Return value:
+ *      void
+ */
+void buffer_cursors_delete_char(Buffer *buf);
+
+/**
+ *  buffer_cursors_backspace(buf)
+ *
+ *  Purpose:
+ *      This function deletes the character in front of every cursor and
+ *      moves the cursors onto the deleted position in one pass. Cursors
+ *      at the start of a line do nothing.
+ *  Return value:
+ *      void
+ */
+void buffer_cursors_backspace(Buffer *buf);
+
+/**
+ *  buffer_cursors_insert_line(buf)
+ *
+ *  Purpose:
+ *      This function inserts an empty line below every line that has a
+ *      cursor and moves those cursors to the new lines. The line index is
+ *      rebuilt once for all of the new lines.
+ *  Return value:
+ *      void
+ */
+void buffer_cursors_insert_line(Buffer *buf);
+
 #endif // _BUFFER_H_
@@ -0,0 +1,140 @@
+#include "command.h"
+
+#include <stdlib.h>
+#include <wctype.h>
+
+const char *command_execute(Buffer *buf, State *state, const wchar_t *cmd) {
+    if (buf == NULL || state == NULL || cmd == NULL)
+        return "Invalid command!";
+
+    while (iswspace(*cmd)) {
+        cmd++;
+    }
+    if (*cmd == L'\0')
+        return NULL;
+
+    if (wcscmp(cmd, L"$") == 0) {
+        buffer_move_cursor_to_line(buf, buf->size - 1);
+        return NULL;
+    }
+    if (iswdigit(*cmd)) {
+        wchar_t *end;
+        unsigned long line = wcstoul(cmd, &end, 10);
+        if (*end != L'\0')
+            return "Invalid line number!";
+        // Line numbers start at 1, ':0' goes to the first line just like
+        // ':1' does
+        buffer_move_cursor_to_line(buf, line > 0 ? line - 1 : 0);
+        return NULL;
+    }
+    if (wcscmp(cmd, L"set relativenumber") == 0 ||
+        wcscmp(cmd, L"set rnu") == 0) {
+        state->relative_numbers = true;
+        return NULL;
+    }
+    if (wcscmp(cmd, L"set norelativenumber") == 0 ||
+        wcscmp(cmd, L"set nornu") == 0) {
+        state->relative_numbers = false;
+        return NULL;
+    }
+    if (wcsncmp(cmd, L"set maxmem=", 11) == 0) {
+        wchar_t *end;
+        unsigned long mib = wcstoul(cmd + 11, &end, 10);
+        if (!iswdigit(cmd[11]) || *end != L'\0')
+            return "Invalid size!";
+        // Buffers that are mapped already keep as many blocks as fit from
+        // now on, other buffers stay the way they have been read
+        state->max_mem = (size_t)mib << 20;
+        return NULL;
+    }
+    if (wcscmp(cmd, L"close") == 0 || wcscmp(cmd, L"clo") == 0) {
+        state->view_command = VIEW_CLOSE;
+        return NULL;
+    }
+    const wchar_t *arg;
+    if ((arg = command_match_word(cmd, L"split")) != NULL ||
+        (arg = command_match_word(cmd, L"sp")) != NULL) {
+        return command_view(state, VIEW_SPLIT, arg);
+    }
+    if ((arg = command_match_word(cmd, L"vsplit")) != NULL ||
+        (arg = command_match_word(cmd, L"vs")) != NULL) {
+        return command_view(state, VIEW_VSPLIT, arg);
+    }
+    if (cmd[0] == L's') {
+        return command_substitute(buf, cmd + 1, buf->cursor_y, buf->cursor_y);
+    }
+    if (cmd[0] == L'%' && cmd[1] == L's') {
+        return command_substitute(buf, cmd + 2, 0, buf->size - 1);
+    }
+    return "Unknown command!";
+}
+
+static const wchar_t *command_parse_part(const wchar_t *cmd, wchar_t delim,
+                                         wchar_t *out) {
+    size_t len = 0;
+    for (; *cmd != L'\0' && *cmd != delim; ++cmd) {
+        if (*cmd == L'\\' && (cmd[1] == delim || cmd[1] == L'\\')) {
+            cmd++;
+        }
+        if (len < MAX_COMMAND_SIZE - 1) {
+            out[len++] = *cmd;
+        }
+    }
+    out[len] = L'\0';
+    return *cmd == delim ? cmd + 1 : cmd;
+}
+
+static const wchar_t *command_match_word(const wchar_t *cmd,
+                                         const wchar_t *word) {
+    size_t len = wcslen(word);
+    if (wcsncmp(cmd, word, len) != 0)
+        return NULL;
+    cmd += len;
+    if (*cmd != L'\0' && !iswspace(*cmd))
+        return NULL;
+    while (iswspace(*cmd)) {
+        cmd++;
+    }
+    return cmd;
+}
+
+static const char *command_view(State *state, enum ViewCommand command,
+                                const wchar_t *path) {
+    if (state->headless)
+        return "Views are not available in headless mode!";
+    size_t len = wcstombs(state->view_path, path, MAX_PATH_SIZE);
+    if (len == (size_t)-1 || len >= MAX_PATH_SIZE) {
+        state->view_path[0] = '\0';
+        return "Invalid path!";
+    }
+    state->view_command = command;
+    return NULL;
+}
+
+static const char *command_substitute(Buffer *buf, const wchar_t *cmd,
+                                      size_t first, size_t last) {
+    // Just like in vim, any punctuation may be used as the delimiter
+    wchar_t delim = *cmd;
+    if (delim == L'\0' || iswalnum(delim) || iswspace(delim) ||
+        delim == L'\\')
+        return "Invalid substitution!";
+
+    wchar_t pattern[MAX_COMMAND_SIZE];
+    wchar_t replacement[MAX_COMMAND_SIZE];
+    cmd = command_parse_part(cmd + 1, delim, pattern);
+    cmd = command_parse_part(cmd, delim, replacement);
+    if (pattern[0] == L'\0')
+        return "Empty pattern!";
+
+    bool global = false;
+    for (; *cmd != L'\0'; ++cmd) {
+        if (*cmd != L'g')
+            return "Invalid substitution flags!";
+        global = true;
+    }
+
+    if (buffer_substitute(buf, first, last, pattern, replacement, global) ==
+        0)
+        return "Pattern not found!";
+    return NULL;
+}
@@ -0,0 +1,88 @@
+#ifndef _COMMAND_H_
+#define _COMMAND_H_
+
+#include "buffer.h"
+#include "defs.h"
+#include <wchar.h>
+
+/**
+ *  command_execute(buf, state, cmd)
+ *
+ *  Purpose:
+ *      This function executes the command 'cmd' that has been typed
+ *      in command mode (without the leading ':') on the buffer 'buf'.
+ *      Supported commands:
+ *          <n> - move the cursor to line n
+ *          $   - move the cursor to the last line
+ *          s/pattern/replacement/[g] - replace 'pattern' on the current
+ *                                      line, every occurrence with 'g'
+ *          %s/pattern/replacement/[g] - same as 's' for every line
+ *          set [no]relativenumber (or [no]rnu) - show line numbers
+ *                                                relative to the cursor
+ *          set maxmem=<n> - map files larger than n MiB, only the
+ *                           parts in use are kept in memory (0 reads
+ *                           every file at once)
+ *          split [file] (or sp) - show 'file' or the buffer once more
+ *                                 below the current view
+ *          vsplit [file] (or vs) - same as 'split' right of the view
+ *          close (or clo) - close the current view
+ *  Return value:
+ *      NULL - The command was executed successfully
+ *      const char* - A message describing why the command failed
+ */
+const char *command_execute(Buffer *buf, State *state, const wchar_t *cmd);
+
+/**
+ *  command_parse_part(cmd, delim, out)
+ *
+ *  Purpose:
+ *      This function copies 'cmd' into 'out' until the first 'delim'
+ *      that is not escaped by a backslash. '\\' is copied as a single
+ *      backslash. 'out' needs to fit MAX_COMMAND_SIZE characters.
+ *  Return value:
+ *      const wchar_t* - the character behind the delimiter or the end of
+ *                       'cmd' if there is no delimiter
+ */
+static const wchar_t *command_parse_part(const wchar_t *cmd, wchar_t delim,
+                                         wchar_t *out);
+
+/**
+ *  command_match_word(cmd, word)
+ *
+ *  Purpose:
+ *      This function checks whether 'cmd' starts with the whole word
+ *      'word', followed by the end of 'cmd' or whitespace.
+ *  Return value:
+ *      NULL - 'cmd' does not start with 'word'
+ *      const wchar_t* - the argument behind 'word' and the whitespace
+ */
+static const wchar_t *command_match_word(const wchar_t *cmd,
+                                         const wchar_t *word);
+
+/**
+ *  command_view(state, command, path)
+ *
+ *  Purpose:
+ *      This function requests the view change 'command' for the file
+ *      'path' (empty for the current buffer), see State.view_command.
+ *  Return value:
+ *      NULL - The change has been requested
+ *      const char* - A message describing why it has not been requested
+ */
+static const char *command_view(State *state, enum ViewCommand command,
+                                const wchar_t *path);
+
+/**
+ *  command_substitute(buf, cmd, first, last)
+ *
+ *  Purpose:
+ *      This function parses the substitution 'cmd' (everything after the
+ *      's') and applies it to the lines 'first' to 'last'.
+ *  Return value:
+ *      NULL - At least one occurrence has been replaced
+ *      const char* - A message describing why nothing was replaced
+ */
+static const char *command_substitute(Buffer *buf, const wchar_t *cmd,
+                                      size_t first, size_t last);
+
+#endif // _COMMAND_H_
@@ -1,9 +1,14 @@
 #ifndef _DEFS_H_
 #define _DEFS_H_
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <wchar.h>
 
 #define MAX_LINE_SIZE 512
+#define MAX_COMMAND_SIZE 256
+// a path typed in command mode, every character takes up to 4 bytes
+#define MAX_PATH_SIZE (MAX_COMMAND_SIZE * 4)
 #define CTRL(k) ((k) & 0x1f)
 #define KEY_ESCAPE 27
 #define KEY_TAB 9
@@ -12,18 +17,30 @@
     printf("\033[%d q", (style));                                              \
     fflush(stdout);
 
-static const char *mode_names[] = {"NORMAL", "INSERT", "VISUAL", "SEARCH"};
+static const char *mode_names[] = {"NORMAL", "INSERT", "VISUAL", "SEARCH",
+                                   "COMMAND"};
 enum Mode {
     MODE_NORMAL,
     MODE_INSERT,
     MODE_VISUAL,
     MODE_SEARCH,
+    MODE_COMMAND,
 
     // reserved mode that tells us the length of the enum
     // for checks in e.g. main.c:mode_get_name()
     MODE_LENGTH
 };
 
+// Changes to the views on the screen (see view.h), requested by a mode and
+// carried out by main.c
+enum ViewCommand {
+    VIEW_NONE,
+    VIEW_SPLIT,  // show a view below the current one
+    VIEW_VSPLIT, // show a view right of the current one
+    VIEW_NEXT,   // move the focus to the next view
+    VIEW_CLOSE   // close the current view
+};
+
 enum CursorStyle {
     // see:
     // https://invisible-island.net/xterm/ctlseqs/ctlseqs.html#h4-Functions-using-CSI-_-ordered-by-the-final-character-lparen-s-rparen:CSI-Ps-SP-q.1D81
@@ -37,11 +54,47 @@ enum CursorStyle {
 };
 
 typedef struct _State_ {
-    size_t line_size;
     size_t max_y;
     size_t max_x;
 
+    // soft wrap lines that are wider than the text window
+    bool wrap;
+    // show line numbers relative to the cursor line (see gutter.h)
+    bool relative_numbers;
+    // show the performance HUD in the infobar (see profile.h)
+    bool show_hud;
+    // files larger than this many bytes are mapped and only the parts of
+    // them that are in use are kept in memory (see Buffer), 0 reads every
+    // file at once
+    size_t max_mem;
+
+    // key that started a command consisting of multiple keys (e.g. the
+    // first 'g' of 'gg'), 0 if there is none
+    wint_t pending_key;
+
+    // line the selection of visual mode started at, the selection reaches
+    // from there to the cursor line
+    size_t visual_y;
+
+    // text typed in command mode, always null-terminated
+    wchar_t command[MAX_COMMAND_SIZE];
+    size_t command_size;
+
     enum Mode current_mode;
+
+    // pending change to the views and the file the new view shows, an
+    // empty path shows the current buffer once more
+    enum ViewCommand view_command;
+    char view_path[MAX_PATH_SIZE];
+
+    // message shown in the infobar until the next key is pressed, NULL if
+    // there is none
+    const char *message;
+
+    // no terminal is attached (see script.h), nothing may be written to it
+    bool headless;
+    // set by a headless save that could not write the file
+    bool save_failed;
 } State;
 
 #endif // _DEFS_H_
@@ -0,0 +1,104 @@
+#include "gutter.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Stored for rows whose content is unknown, no line has that number
+#define GUTTER_UNKNOWN SIZE_MAX
+
+size_t gutter_digits(size_t n) {
+    size_t digits = 1;
+    while (n >= 10) {
+        n /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+size_t gutter_width(size_t line_count) {
+    return gutter_digits(line_count) + GUTTER_PADDING;
+}
+
+void gutter_invalidate(Gutter *gutter) {
+    for (size_t y = 0; y < gutter->height; ++y) {
+        gutter->rows[y] = GUTTER_UNKNOWN;
+    }
+}
+
+void gutter_layout(Gutter *gutter, size_t line_count, size_t height,
+                   bool relative) {
+    if (gutter == NULL)
+        return;
+
+    size_t width = gutter_width(line_count);
+    if (height != gutter->height) {
+        size_t *rows = realloc(gutter->rows, height * sizeof(size_t));
+        if (rows == NULL && height > 0) {
+            // Without the cache, every row is drawn in every frame
+            free(gutter->rows);
+            height = 0;
+        }
+        gutter->rows = rows;
+        gutter->height = height;
+    } else if (width == gutter->width && relative == gutter->relative) {
+        return;
+    }
+    gutter->width = width;
+    gutter->relative = relative;
+    gutter_invalidate(gutter);
+}
+
+size_t gutter_number(const Gutter *gutter, size_t line, size_t cursor_y) {
+    if (!gutter->relative || line == cursor_y)
+        return line + 1;
+    return line > cursor_y ? line - cursor_y : cursor_y - line;
+}
+
+void gutter_draw_row(Gutter *gutter, WINDOW *win, size_t y, size_t number) {
+    if (gutter == NULL || gutter->width <= GUTTER_PADDING)
+        return;
+    if (y < gutter->height) {
+        if (gutter->rows[y] == number)
+            return;
+        gutter->rows[y] = number;
+    }
+
+    // The row is formatted by hand, right-aligned in front of the padding.
+    // The last column is never written, it always stays empty.
+    char row[sizeof(size_t) * 3 + GUTTER_PADDING];
+    size_t len = gutter->width - 1;
+    if (len > sizeof(row)) {
+        len = sizeof(row);
+    }
+    size_t end = gutter->width - GUTTER_PADDING;
+    for (size_t x = end; x < len; ++x) {
+        row[x] = ' ';
+    }
+    size_t x = end;
+    if (number > 0) {
+        do {
+            row[--x] = '0' + number % 10;
+            number /= 10;
+        } while (number > 0 && x > 0);
+    }
+    while (x > 0) {
+        row[--x] = ' ';
+    }
+    mvwaddnstr(win, y, 0, row, len);
+    gutter->drawn = true;
+}
+
+void gutter_refresh(Gutter *gutter, WINDOW *win) {
+    if (gutter == NULL || !gutter->drawn)
+        return;
+    wnoutrefresh(win);
+    gutter->drawn = false;
+}
+
+void gutter_free(Gutter *gutter) {
+    if (gutter == NULL)
+        return;
+    free(gutter->rows);
+    gutter->rows = NULL;
+    gutter->height = 0;
+}
@@ -0,0 +1,121 @@
+#ifndef _GUTTER_H_
+#define _GUTTER_H_
+
+#include <ncurses.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Blank columns between the line numbers and the text
+#define GUTTER_PADDING 2
+
+// The line numbers left of the text. Every row of the window remembers the
+// number that is drawn in it, a row is only drawn again once its number
+// changes. That way the gutter is not touched at all while typing, only
+// scrolling, moving the cursor with relative numbers or a change of the
+// width causes rows to be drawn.
+typedef struct _Gutter_ {
+    // digits of the line count + GUTTER_PADDING
+    size_t width;
+    // show the distance to the cursor line instead of the line number,
+    // the cursor line itself keeps its line number
+    bool relative;
+
+    // number drawn in every row of the window, 0 for an empty row
+    size_t *rows;
+    size_t height;
+
+    // set once a row has been drawn since the last gutter_refresh
+    bool drawn;
+} Gutter;
+
+/**
+ *  gutter_digits(n)
+ *
+ *  Purpose:
+ *      This function counts the decimal digits of 'n'.
+ *      Example: 1234 -> 4, 12 -> 2, 0 -> 1
+ *  Return value:
+ *      size_t - amount of digits
+ */
+size_t gutter_digits(size_t n);
+
+/**
+ *  gutter_width(line_count)
+ *
+ *  Purpose:
+ *      This function calculates how wide the gutter of a buffer with
+ *      'line_count' lines is.
+ *  Return value:
+ *      size_t - width in columns, including the padding
+ */
+size_t gutter_width(size_t line_count);
+
+/**
+ *  gutter_layout(gutter, line_count, height, relative)
+ *
+ *  Purpose:
+ *      This function is called once per frame before any row is drawn.
+ *      If the width for 'line_count' lines, the 'height' of the window or
+ *      the 'relative' setting changed, every row is drawn again.
+ *  Return value:
+ *      void
+ */
+void gutter_layout(Gutter *gutter, size_t line_count, size_t height,
+                   bool relative);
+
+/**
+ *  gutter_number(gutter, line, cursor_y)
+ *
+ *  Purpose:
+ *      This function looks up the number shown for the line at index
+ *      'line' while the cursor is at line 'cursor_y'.
+ *  Return value:
+ *      size_t - the number, which is never 0
+ */
+size_t gutter_number(const Gutter *gutter, size_t line, size_t cursor_y);
+
+/**
+ *  gutter_draw_row(gutter, win, y, number)
+ *
+ *  Purpose:
+ *      This function draws 'number' right-aligned into row 'y' of 'win',
+ *      unless it already is drawn there. A 'number' of 0 leaves the row
+ *      empty (rows of wrapped lines and rows behind the last line).
+ *  Return value:
+ *      void
+ */
+void gutter_draw_row(Gutter *gutter, WINDOW *win, size_t y, size_t number);
+
+/**
+ *  gutter_refresh(gutter, win)
+ *
+ *  Purpose:
+ *      This function marks 'win' for the next doupdate, but only if a row
+ *      has been drawn since the last call.
+ *  Return value:
+ *      void
+ */
+void gutter_refresh(Gutter *gutter, WINDOW *win);
+
+/**
+ *  gutter_invalidate(gutter)
+ *
+ *  Purpose:
+ *      This function forgets what is drawn in every row, so that every
+ *      row is drawn in the next frame.
+ *  Return value:
+ *      void
+ */
+void gutter_invalidate(Gutter *gutter);
+
+/**
+ *  gutter_free(gutter)
+ *
+ *  Purpose:
+ *      This function free's all of the memory allocated by the gutter.
+ *  Return value:
+ *      void
+ */
+void gutter_free(Gutter *gutter);
+
+#endif // _GUTTER_H_
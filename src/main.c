@@ -1,265 +1,334 @@
 #include <locale.h>
-#include <math.h>
 #include <ncurses.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <wchar.h>
 #include <wctype.h>
 
 #include "buffer.h"
 #include "defs.h"
+#include "mode.h"
+#include "profile.h"
+#include "script.h"
+#include "view.h"
 
-const char *mode_get_name(enum Mode mode);
+// how often the progress of a running save is drawn, in milliseconds
+#define MAIN_SAVE_REDRAW 100
 
-bool mode_handle_normal(Buffer *buf, State *state, wint_t c);
-bool mode_handle_insert(Buffer *buf, State *state, wint_t c);
-bool mode_handle_visual(Buffer *buf, State *state, wint_t c);
-bool mode_handle_search(Buffer *buf, State *state, wint_t c);
-
-// array of function pointers to handle all modes
-// accepts Buffer, State and current character and
-// returns wether the editor should be closed.
-bool (*mode_funcs[])(Buffer *buf, State *state,
-                     wint_t c) = {mode_handle_normal, mode_handle_insert,
-                                  mode_handle_visual, mode_handle_search};
-
-Buffer buf = {0};
 State state = {0};
 
-char *info_msg = NULL;
+/**
+ *  main_view_command(root, focused)
+ *
+ *  Purpose:
+ *      This function carries out the change to the views that has been
+ *      requested in 'state', 'focused' is the loaded view with the focus.
+ *  Return value:
+ *      View* - the view with the focus afterwards, which is loaded
+ *      NULL - The last view has been closed
+ */
+static View *main_view_command(Split **root, View *focused) {
+    enum ViewCommand command = state.view_command;
+    state.view_command = VIEW_NONE;
+
+    View *views[VIEW_MAX];
+    size_t count = split_views(*root, views, VIEW_MAX);
+    switch (command) {
+    case VIEW_NONE: {
+    } break;
+    case VIEW_SPLIT:
+    case VIEW_VSPLIT: {
+        bool vertical = command == VIEW_VSPLIT;
+        if (count == VIEW_MAX || !view_can_split(focused, vertical)) {
+            state.message = "Not enough space for another view!";
+            break;
+        }
+        Buffer *buf = focused->buf;
+        if (state.view_path[0] != '\0') {
+            buf = split_open_buffer(*root, state.view_path, &state);
+            // Errors are printed right into the screen
+            clearok(curscr, TRUE);
+            if (buf == NULL) {
+                state.message = "Failed to open file!";
+                break;
+            }
+        }
+        // The new view starts where the focused one is
+        view_store(focused);
+        View *view = view_new(buf);
+        if (!split_view(*root, focused, view, vertical)) {
+            view_free(view);
+            split_free_buffer(*root, buf);
+            state.message = "Failed to allocate space for view!";
+            break;
+        }
+        focused = view;
+        view_load(focused);
+    } break;
+    case VIEW_NEXT: {
+        size_t i = 0;
+        while (i < count && views[i] != focused) {
+            i++;
+        }
+        view_store(focused);
+        focused = views[(i + 1) % count];
+        view_load(focused);
+    } break;
+    case VIEW_CLOSE: {
+        focused = split_close(root, focused);
+        view_load(focused);
+    } break;
+    }
+    return focused;
+}
 
 int main(int argc, char **argv) {
-    if (argc <= 1 || argv[1] == NULL) {
+    const char *script_path = NULL;
+    Split *root = NULL;
+    View *focused = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        switch (opt) {
+        case 's': {
+            script_path = optarg;
+        } break;
+        default: {
+            script_path = NULL;
+            optind = argc;
+        } break;
+        }
+    }
+
+    if (optind >= argc || argv[optind] == NULL) {
         printf("Usage: %s <filename>\n", argv[0]);
+        printf("       %s -s <script> <filename>...\n", argv[0]);
         return 1;
+    } else if (script_path != NULL) {
+        // Headless mode, no terminal is being used at all
+        setlocale(LC_ALL, "");
+        PROFILE_INIT();
+        int res = script_run(script_path, &argv[optind], argc - optind);
+        PROFILE_SHUTDOWN();
+        return res;
     } else {
         setlocale(LC_ALL, "");
-        buf.state = &state;
-        if (!buffer_read_from_file(&buf, argv[1])) {
+        PROFILE_INIT();
+        state.max_mem = BUFFER_DEFAULT_MAX_MEM;
+        PROFILE_BEGIN(PROFILE_READ);
+        Buffer *buf = split_open_buffer(NULL, argv[optind], &state);
+        PROFILE_END(PROFILE_READ);
+        if (buf == NULL) {
+            return 1;
+        }
+        focused = view_new(buf);
+        root = split_new(focused);
+        if (root == NULL) {
+            printf("Failed to allocate space for view.\n");
             return 1;
         }
     }
 
-    // hacky thing to calculate the length of an integer
-    // Example: 1234 -> 4, 12 -> 2, 62332 -> 5
-    state.line_size = floor(log10(buf.size)) + 3;
-
     initscr();
-    move(buf.cursor_y, buf.cursor_x + state.line_size + 1);
     refresh();
     noecho();
     raw();
 
     size_t infobar_height = 2;
     getmaxyx(stdscr, state.max_y, state.max_x);
-    WINDOW *line_win =
-        newwin(state.max_y - infobar_height, state.line_size, 0, 0);
-    WINDOW *text_win =
-        newwin(state.max_y - infobar_height, state.max_x - state.line_size, 0,
-               state.line_size);
     WINDOW *infobar_win =
         newwin(infobar_height, state.max_x, state.max_y - infobar_height, 0);
-    keypad(text_win, TRUE);
     keypad(infobar_win, TRUE);
 
-    state.max_y -= infobar_height;
-    buf.cursor_max = state.max_y;
-
+    View *views[VIEW_MAX];
     int c_result;
-    wint_t c;
-    bool close_requested = false;
-    while (c != CTRL('q') && !close_requested) {
-        werase(line_win);
-        werase(text_win);
+    wint_t c = 0;
+    while (focused != NULL && c != CTRL('q')) {
+        PROFILE_BEGIN(PROFILE_RENDER);
         werase(infobar_win);
 
-        if (is_term_resized(state.max_y, state.max_x)) {
-            getmaxyx(stdscr, state.max_y, state.max_x);
-            state.max_y -= infobar_height;
-        }
-
-        wresize(line_win, state.max_y, state.line_size);
-        mvwin(line_win, 0, 0);
-        wresize(text_win, state.max_y, state.max_x - state.line_size);
-        mvwin(text_win, 0, state.line_size);
+        size_t screen_y;
+        size_t screen_x;
+        getmaxyx(stdscr, screen_y, screen_x);
+        size_t count = split_views(root, views, VIEW_MAX);
+        split_layout(root, 0, 0, screen_y - infobar_height, screen_x,
+                     count > 1);
 
-        Line *itr = buf.first_line;
-        for (size_t i = 0; i < buf.size; ++i) {
-            size_t l_size = floor(log10(i + 1)) + 1;
-            if (buf.cursor_y >= state.max_y) {
-                buf.scroll_y = buf.cursor_max - state.max_y + 1;
-            } else {
-                // FIXME: This causes a weird clipping that should be removed
-                buf.scroll_y = 0;
+        // Every view is drawn with its own cursors. Views of the same
+        // buffer share its lines, the cursors of the focused view are only
+        // put back if another view of its buffer has been drawn.
+        bool shared = false;
+        for (size_t i = 0; i < count; ++i) {
+            shared = shared ||
+                     (views[i] != focused && views[i]->buf == focused->buf);
+        }
+        if (shared) {
+            view_store(focused);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (views[i] != focused) {
+                view_load(views[i]);
+                view_draw(views[i], &state, false);
+                view_store(views[i]);
             }
+        }
+        if (shared) {
+            view_load(focused);
+        }
+        view_draw(focused, &state, true);
 
-            mvwprintw(line_win, i - buf.scroll_y, state.line_size - 2 - l_size,
-                      "%zu", i + 1);
-            if (itr->size != 0) {
-                Character *c_itr = itr->first_char;
-                size_t j = 0;
-                while (c_itr != NULL) {
-                    mvwprintw(text_win, i - buf.scroll_y, j, "%C",
-                              c_itr->value);
-                    j += wcwidth(c_itr->value);
-                    c_itr = c_itr->next;
+        // Saves are finished by the first frame after their writer is done
+        Buffer *saving = NULL;
+        for (size_t i = 0; i < count; ++i) {
+            switch (buffer_save_finish(views[i]->buf, false)) {
+            case BUFFER_SAVE_NONE: {
+            } break;
+            case BUFFER_SAVE_RUNNING: {
+                if (saving == NULL || views[i] == focused) {
+                    saving = views[i]->buf;
                 }
+            } break;
+            case BUFFER_SAVE_DONE: {
+                state.message = "Saved file";
+            } break;
+            case BUFFER_SAVE_FAILED: {
+                state.message = views[i]->buf->map_lost
+                                    ? "File was truncated, not saved!"
+                                    : "Failed to save file!";
+            } break;
             }
-            itr = itr->next;
         }
+        // The modes work with the size of the focused view
+        state.max_y = focused->height - focused->status;
+        state.max_x = focused->width - focused->border;
+
         wprintw(infobar_win, "%s @ %s\n", mode_get_name(state.current_mode),
-                buf.file_path);
-        if (info_msg != NULL) {
-            wprintw(infobar_win, "%s", info_msg);
+                focused->buf->file_path);
+        if (state.current_mode == MODE_COMMAND) {
+            wprintw(infobar_win, ":%ls", state.command);
+#ifdef PED_PROFILE
+        } else if (state.show_hud) {
+            char hud[256];
+            profile_format_hud(hud, sizeof(hud));
+            wprintw(infobar_win, "%s", hud);
+#endif
+        } else if (state.message != NULL) {
+            wprintw(infobar_win, "%s", state.message);
+        } else if (saving != NULL) {
+            wprintw(infobar_win, "Saving %s... %zu%%", saving->file_path,
+                    buffer_save_progress(saving));
         }
-        move(buf.cursor_y - buf.scroll_y,
-             buf.render_cursor_x + state.line_size);
 
-        wrefresh(line_win);
-        wrefresh(text_win);
-        wrefresh(infobar_win);
-        refresh();
+        // All windows are written to the screen with a single update, the
+        // terminal cursor ends up at the cursor of the last window
+        wnoutrefresh(infobar_win);
+        if (state.current_mode != MODE_COMMAND) {
+            wnoutrefresh(focused->text_win);
+        }
+        doupdate();
+        PROFILE_END(PROFILE_RENDER);
 
-        c_result = wget_wch(text_win, &c);
+        // While following a file, input is not waited for inside of ncurses
+        // since changes to the file need to wake us up as well
+        struct pollfd fds[1 + VIEW_MAX] = {
+            {.fd = STDIN_FILENO, .events = POLLIN}};
+        View *followed[VIEW_MAX];
+        size_t follow_count = 0;
+        for (size_t i = 0; i < count; ++i) {
+            Buffer *buf = views[i]->buf;
+            size_t j = 0;
+            while (j < follow_count && followed[j]->buf != buf) {
+                j++;
+            }
+            if (buf->follow && j == follow_count) {
+                followed[follow_count] =
+                    buf == focused->buf ? focused : views[i];
+                fds[1 + follow_count].fd = buf->watch_fd;
+                fds[1 + follow_count].events = POLLIN;
+                follow_count++;
+            }
+        }
+        // A running save wakes us up to draw its progress
+        int timeout = saving != NULL ? MAIN_SAVE_REDRAW : -1;
+        wtimeout(focused->text_win, follow_count > 0 ? 0 : timeout);
+        PROFILE_BEGIN(PROFILE_INPUT_WAIT);
+        c_result = wget_wch(focused->text_win, &c);
+        PROFILE_END(PROFILE_INPUT_WAIT);
+        if (c_result == ERR && follow_count > 0) {
+            PROFILE_BEGIN(PROFILE_INPUT_WAIT);
+            poll(fds, 1 + follow_count, timeout);
+            PROFILE_END(PROFILE_INPUT_WAIT);
+            for (size_t j = 0; j < follow_count; ++j) {
+                if (!(fds[1 + j].revents & POLLIN))
+                    continue;
+                // The focused view stays loaded, any other view of a
+                // followed buffer is loaded just for the update
+                View *view = followed[j];
+                if (view != focused) {
+                    view_load(view);
+                }
+                buffer_follow_update(view->buf);
+                if (view != focused) {
+                    view_store(view);
+                }
+            }
+            continue;
+        }
+        if (c_result == ERR && saving != NULL) {
+            continue;
+        }
         if (c_result == ERR) {
-            info_msg = "Invalid character!";
+            state.message = "Invalid character!";
             continue;
         }
-        if (info_msg != NULL) {
-            info_msg = NULL;
+        if (state.message != NULL) {
+            state.message = NULL;
         }
 
-        close_requested = mode_funcs[state.current_mode](&buf, &state, c);
-    }
-
-    delwin(line_win);
-    delwin(text_win);
-    delwin(infobar_win);
-    endwin();
-
-    buffer_free(&buf);
-    return 0;
-}
-
-const char *mode_get_name(enum Mode mode) {
-    if (mode < 0 || mode >= MODE_LENGTH)
-        return "UNKNOWN";
-    return mode_names[mode];
-}
-
-bool mode_handle_normal(Buffer *buf, State *state, wint_t c) {
-    switch (c) {
-    case KEY_DOWN:
-    case 'j': {
-        buffer_move_cursor_down(buf);
-    } break;
-    case KEY_UP:
-    case 'k': {
-        buffer_move_cursor_up(buf);
-    } break;
-    case KEY_RIGHT:
-    case 'l': {
-        buffer_move_cursor_right(buf);
-    } break;
-    case KEY_LEFT:
-    case 'h': {
-        buffer_move_cursor_left(buf);
-    } break;
-    case 'i': {
-        SET_CURSOR_STYLE(CURSOR_BAR);
-        state->current_mode = MODE_INSERT;
-    } break;
-    case 'a': {
-        state->current_mode = MODE_INSERT;
-    } break;
-    case 'v': {
-        state->current_mode = MODE_VISUAL;
-    } break;
-    case '/': {
-        state->current_mode = MODE_SEARCH;
-    } break;
-    case CTRL('s'): {
-        if (buffer_save(buf, buf->file_path)) {
-            return true;
-        } else {
-            info_msg = "Failed to save file!";
+        enum Mode mode = state.current_mode;
+        PROFILE_BEGIN(PROFILE_MODE_NORMAL + mode);
+        // Only scripts stop after saving, see mode_handle_normal
+        mode_funcs[mode](focused->buf, &state, c);
+        PROFILE_END(PROFILE_MODE_NORMAL + mode);
+        if (state.view_command != VIEW_NONE) {
+            focused = main_view_command(&root, focused);
         }
-    } break;
+        PROFILE_FRAME_END();
     }
-    return false;
-}
 
-bool mode_handle_insert(Buffer *buf, State *state, wint_t c) {
-    switch (c) {
-    case KEY_DOWN: {
-        buffer_move_cursor_down(buf);
-    } break;
-    case KEY_UP: {
-        buffer_move_cursor_up(buf);
-    } break;
-    case KEY_RIGHT: {
-        buffer_move_cursor_right(buf);
-    } break;
-    case KEY_LEFT: {
-        buffer_move_cursor_left(buf);
-    } break;
-    case KEY_ESCAPE: {
-        SET_CURSOR_STYLE(CURSOR_BLOCK);
-        state->current_mode = MODE_NORMAL;
-    } break;
-    case KEY_DC: {
-        buffer_delete_char_at_cursor(buf);
-    } break;
-    case KEY_BACKSPACE: {
-        Line *lin = buffer_find_line(buf, buf->cursor_y);
-        if (lin == NULL)
-            break;
-        if (lin->size <= 0 && lin != buf->last_line && lin != buf->first_line) {
-            if (buffer_delete_line(buf, lin)) {
-                // Update rendering vars
-                state->line_size = floor(log10(buf->size)) + 3;
-            }
-            break;
+    // Closing the last view of a buffer waits for its save
+    bool save_failed = false;
+    if (focused != NULL) {
+        size_t count = split_views(root, views, VIEW_MAX);
+        bool waiting = false;
+        for (size_t i = 0; i < count; ++i) {
+            waiting = waiting || views[i]->buf->save != NULL;
         }
-
-        if (buffer_delete_char_at_cursor_x(buf, buf->cursor_x - 1)) {
-            if (buffer_move_render_cursor_x(buf, buf->cursor_x - 1, -1)) {
-                buf->cursor_x--;
-            }
+        if (waiting) {
+            werase(infobar_win);
+            wprintw(infobar_win, "Waiting for the save to finish...");
+            wrefresh(infobar_win);
         }
-    } break;
-    case KEY_TAB: {
-        buffer_append_char_at_cursor(buf, '\t');
-    } break;
-    case KEY_ENTER1: {
-        if (buffer_insert_line_at_cursor(buf)) {
-            // Update rendering vars
-            state->line_size = floor(log10(buf->size)) + 3;
+        for (size_t i = 0; i < count; ++i) {
+            if (buffer_save_finish(views[i]->buf, true) ==
+                BUFFER_SAVE_FAILED) {
+                save_failed = true;
+            }
         }
-    } break;
-    default: {
-        buffer_append_char_at_cursor(buf, c);
-    } break;
     }
-    return false;
-}
-
-bool mode_handle_visual(Buffer *buf, State *state, wint_t c) {
-    switch (c) {
-    case KEY_ESCAPE: {
-        state->current_mode = MODE_NORMAL;
-    } break;
+    while (focused != NULL) {
+        focused = split_close(&root, focused);
+        view_load(focused);
     }
-    return false;
-}
-
-bool mode_handle_search(Buffer *buf, State *state, wint_t c) {
-    switch (c) {
-    case KEY_ESCAPE: {
-        state->current_mode = MODE_NORMAL;
-    } break;
+    delwin(infobar_win);
+    endwin();
+    if (save_failed) {
+        printf("Failed to save file.\n");
     }
-    return false;
+
+    PROFILE_SHUTDOWN();
+    return save_failed;
 }
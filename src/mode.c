@@ -0,0 +1,345 @@
+#include "mode.h"
+
+#include <ncurses.h>
+#include <stdio.h>
+
+#include "command.h"
+#include "gutter.h"
+#include "profile.h"
+
+bool (*mode_funcs[])(Buffer *buf, State *state,
+                     wint_t c) = {mode_handle_normal, mode_handle_insert,
+                                  mode_handle_visual, mode_handle_search,
+                                  mode_handle_command};
+
+void move_cursor_down(Buffer *buf, State *state) {
+    if (state->wrap) {
+        buffer_move_cursor_row_down(buf, state->max_x - gutter_width(buf->size));
+    } else {
+        buffer_move_cursor_down(buf);
+    }
+}
+
+void move_cursor_up(Buffer *buf, State *state) {
+    if (state->wrap) {
+        buffer_move_cursor_row_up(buf, state->max_x - gutter_width(buf->size));
+    } else {
+        buffer_move_cursor_up(buf);
+    }
+}
+
+const char *mode_get_name(enum Mode mode) {
+    if (mode < 0 || mode >= MODE_LENGTH)
+        return "UNKNOWN";
+    return mode_names[mode];
+}
+
+bool mode_handle_normal(Buffer *buf, State *state, wint_t c) {
+    if (state->pending_key == 'g') {
+        state->pending_key = 0;
+        if (c == 'g') {
+            buffer_move_cursor_to_line(buf, 0);
+        }
+        return false;
+    }
+    if (state->pending_key == CTRL('w')) {
+        state->pending_key = 0;
+        state->view_path[0] = '\0';
+        switch (c) {
+        case 's': {
+            state->view_command = VIEW_SPLIT;
+        } break;
+        case 'v': {
+            state->view_command = VIEW_VSPLIT;
+        } break;
+        case CTRL('w'):
+        case 'w': {
+            state->view_command = VIEW_NEXT;
+        } break;
+        case 'q': {
+            state->view_command = VIEW_CLOSE;
+        } break;
+        }
+        return false;
+    }
+    if (state->pending_key == 'f') {
+        state->pending_key = 0;
+        if (c != KEY_ESCAPE) {
+            buffer_move_cursor_find_char(buf, c);
+        }
+        return false;
+    }
+
+    switch (c) {
+    case KEY_DOWN:
+    case 'j': {
+        move_cursor_down(buf, state);
+    } break;
+    case KEY_UP:
+    case 'k': {
+        move_cursor_up(buf, state);
+    } break;
+    case KEY_RIGHT:
+    case 'l': {
+        buffer_move_cursor_right(buf);
+    } break;
+    case KEY_LEFT:
+    case 'h': {
+        buffer_move_cursor_left(buf);
+    } break;
+    case 'w': {
+        buffer_move_cursor_word_next(buf);
+    } break;
+    case 'b': {
+        buffer_move_cursor_word_prev(buf);
+    } break;
+    case 'e': {
+        buffer_move_cursor_word_end(buf);
+    } break;
+    case 'f':
+    case 'g':
+    case CTRL('w'): {
+        state->pending_key = c;
+    } break;
+    case KEY_HOME:
+    case '0': {
+        buffer_move_cursor_line_start(buf);
+    } break;
+    case KEY_END:
+    case '$': {
+        buffer_move_cursor_line_end(buf);
+    } break;
+    case 'G': {
+        buffer_move_cursor_to_line(buf, buf->size - 1);
+    } break;
+    case CTRL('d'): {
+        size_t half = state->max_y / 2;
+        size_t cursor_y = buf->cursor_y;
+        buffer_scroll_down(buf, half);
+        buffer_move_cursor_to_line(buf, cursor_y + half);
+    } break;
+    case CTRL('u'): {
+        size_t half = state->max_y / 2;
+        size_t cursor_y = buf->cursor_y;
+        buffer_scroll_up(buf, half);
+        buffer_move_cursor_to_line(buf, cursor_y > half ? cursor_y - half : 0);
+    } break;
+    case CTRL('f'): {
+        // Just like in vim, two lines of the old page stay visible
+        buffer_scroll_down(buf, state->max_y > 2 ? state->max_y - 2 : 1);
+    } break;
+    case CTRL('b'): {
+        buffer_scroll_up(buf, state->max_y > 2 ? state->max_y - 2 : 1);
+    } break;
+    case ':': {
+        state->command_size = 0;
+        state->command[0] = L'\0';
+        state->current_mode = MODE_COMMAND;
+    } break;
+    case 'i': {
+        if (!state->headless) {
+            SET_CURSOR_STYLE(CURSOR_BAR);
+        }
+        state->current_mode = MODE_INSERT;
+    } break;
+    case 'a': {
+        state->current_mode = MODE_INSERT;
+    } break;
+    case 'v': {
+        state->visual_y = buf->cursor_y;
+        state->current_mode = MODE_VISUAL;
+    } break;
+    case '/': {
+        state->current_mode = MODE_SEARCH;
+    } break;
+    case 'F': {
+        if (buf->follow) {
+            buffer_follow_stop(buf);
+            state->message = "Stopped following file";
+        } else if (buffer_follow_start(buf)) {
+            state->message = "Following file, press F to stop";
+        } else {
+            state->message = "Failed to follow file!";
+        }
+    } break;
+    case CTRL('n'): {
+        if (!buffer_add_cursor_next_match(buf)) {
+            state->message = "No other match!";
+        }
+    } break;
+    case KEY_ESCAPE: {
+        buffer_clear_cursors(buf);
+    } break;
+    case CTRL('l'): {
+        state->wrap = !state->wrap;
+    } break;
+    case CTRL('p'): {
+#ifdef PED_PROFILE
+        state->show_hud = !state->show_hud;
+#else
+        state->message = "ped was built without --enable-profiling";
+#endif
+    } break;
+    case CTRL('s'): {
+        // Scripts stop once the file is written, the editor keeps going
+        // while the file is written in the background (see main)
+        if (state->headless) {
+            PROFILE_BEGIN(PROFILE_SAVE);
+            bool saved = buffer_save(buf, buf->file_path);
+            PROFILE_END(PROFILE_SAVE);
+            if (saved)
+                return true;
+            state->message = buf->map_lost ? "File was truncated, not saved!"
+                                           : "Failed to save file!";
+            state->save_failed = true;
+        } else if (buf->save != NULL) {
+            state->message = "Already saving!";
+        } else {
+            PROFILE_BEGIN(PROFILE_SAVE);
+            bool started = buffer_save_start(buf, buf->file_path);
+            PROFILE_END(PROFILE_SAVE);
+            if (!started) {
+                state->message = buf->map_lost
+                                     ? "File was truncated, not saved!"
+                                     : "Failed to save file!";
+            }
+        }
+    } break;
+    }
+    return false;
+}
+
+bool mode_handle_insert(Buffer *buf, State *state, wint_t c) {
+    switch (c) {
+    case KEY_DOWN: {
+        move_cursor_down(buf, state);
+    } break;
+    case KEY_UP: {
+        move_cursor_up(buf, state);
+    } break;
+    case KEY_RIGHT: {
+        buffer_move_cursor_right(buf);
+    } break;
+    case KEY_LEFT: {
+        buffer_move_cursor_left(buf);
+    } break;
+    case KEY_ESCAPE: {
+        if (!state->headless) {
+            SET_CURSOR_STYLE(CURSOR_BLOCK);
+        }
+        state->current_mode = MODE_NORMAL;
+    } break;
+    case KEY_DC: {
+        if (buf->cursor_count > 0) {
+            buffer_cursors_delete_char(buf);
+        } else {
+            buffer_delete_char_at_cursor(buf);
+        }
+    } break;
+    case KEY_BACKSPACE: {
+        if (buf->cursor_count > 0) {
+            buffer_cursors_backspace(buf);
+            break;
+        }
+        Line *lin = buffer_find_line(buf, buf->cursor_y);
+        if (lin == NULL)
+            break;
+        if (lin->size <= 0 && lin != buf->last_line && lin != buf->first_line) {
+            buffer_delete_line(buf, lin);
+            break;
+        }
+
+        if (buffer_delete_char_at_cursor_x(buf, buf->cursor_x - 1)) {
+            if (buffer_move_render_cursor_x(buf, buf->cursor_x - 1, -1)) {
+                buf->cursor_x--;
+            }
+        }
+    } break;
+    case KEY_ENTER1: {
+        if (buf->cursor_count > 0) {
+            buffer_cursors_insert_line(buf);
+        } else {
+            buffer_insert_line_at_cursor(buf);
+        }
+    } break;
+    case KEY_TAB:
+    default: {
+        // Every cursor gets the character in a single pass over the buffer
+        if (buf->cursor_count > 0) {
+            buffer_cursors_append_char(buf, c);
+        } else {
+            buffer_append_char_at_cursor(buf, c);
+        }
+    } break;
+    }
+    return false;
+}
+
+bool mode_handle_visual(Buffer *buf, State *state, wint_t c) {
+    switch (c) {
+    case KEY_ESCAPE: {
+        state->current_mode = MODE_NORMAL;
+    } break;
+    case KEY_DOWN:
+    case 'j': {
+        move_cursor_down(buf, state);
+    } break;
+    case KEY_UP:
+    case 'k': {
+        move_cursor_up(buf, state);
+    } break;
+    case 'G': {
+        buffer_move_cursor_to_line(buf, buf->size - 1);
+    } break;
+    case 'I': {
+        // A cursor on every selected line, in the column of the cursor
+        size_t first = state->visual_y;
+        size_t last = buf->cursor_y;
+        if (first > last) {
+            first = buf->cursor_y;
+            last = state->visual_y;
+        }
+        buffer_add_cursor_lines(buf, first, last);
+        if (!state->headless) {
+            SET_CURSOR_STYLE(CURSOR_BAR);
+        }
+        state->current_mode = MODE_INSERT;
+    } break;
+    }
+    return false;
+}
+
+bool mode_handle_search(Buffer *buf, State *state, wint_t c) {
+    switch (c) {
+    case KEY_ESCAPE: {
+        state->current_mode = MODE_NORMAL;
+    } break;
+    }
+    return false;
+}
+
+bool mode_handle_command(Buffer *buf, State *state, wint_t c) {
+    switch (c) {
+    case KEY_ESCAPE: {
+        state->current_mode = MODE_NORMAL;
+    } break;
+    case KEY_BACKSPACE: {
+        if (state->command_size == 0) {
+            state->current_mode = MODE_NORMAL;
+            break;
+        }
+        state->command[--state->command_size] = L'\0';
+    } break;
+    case KEY_ENTER1: {
+        state->current_mode = MODE_NORMAL;
+        state->message = command_execute(buf, state, state->command);
+    } break;
+    default: {
+        if (state->command_size < MAX_COMMAND_SIZE - 1) {
+            state->command[state->command_size++] = c;
+            state->command[state->command_size] = L'\0';
+        }
+    } break;
+    }
+    return false;
+}
@@ -0,0 +1,64 @@
+#ifndef _MODE_H_
+#define _MODE_H_
+
+#include "buffer.h"
+#include "defs.h"
+#include <stdbool.h>
+#include <wchar.h>
+
+// array of function pointers to handle all modes
+// accepts Buffer, State and current character and
+// returns wether the editor should be closed.
+extern bool (*mode_funcs[])(Buffer *buf, State *state, wint_t c);
+
+/**
+ *  mode_get_name(mode)
+ *
+ *  Purpose:
+ *      This function looks up the name of 'mode' that is shown in the
+ *      infobar.
+ *  Return value:
+ *      const char* - name of the mode, "UNKNOWN" if 'mode' is invalid
+ */
+const char *mode_get_name(enum Mode mode);
+
+/**
+ *  move_cursor_down(buf, state)
+ *
+ *  Purpose:
+ *      This function moves the cursor down by one line or by one visual
+ *      row if lines are wrapped.
+ *  Return value:
+ *      void
+ */
+void move_cursor_down(Buffer *buf, State *state);
+
+/**
+ *  move_cursor_up(buf, state)
+ *
+ *  Purpose:
+ *      This function moves the cursor up by one line or by one visual
+ *      row if lines are wrapped.
+ *  Return value:
+ *      void
+ */
+void move_cursor_up(Buffer *buf, State *state);
+
+/**
+ *  mode_handle_<mode>(buf, state, c)
+ *
+ *  Purpose:
+ *      These functions handle the key 'c' that has been pressed while the
+ *      editor is in the respective mode. They only touch 'buf' and 'state',
+ *      messages for the user are stored in 'state->message'.
+ *  Return value:
+ *      true - The editor should be closed
+ *      false - The editor keeps running
+ */
+bool mode_handle_normal(Buffer *buf, State *state, wint_t c);
+bool mode_handle_insert(Buffer *buf, State *state, wint_t c);
+bool mode_handle_visual(Buffer *buf, State *state, wint_t c);
+bool mode_handle_search(Buffer *buf, State *state, wint_t c);
+bool mode_handle_command(Buffer *buf, State *state, wint_t c);
+
+#endif // _MODE_H_
@@ -0,0 +1,156 @@
+#include "profile.h"
+
+#ifdef PED_PROFILE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *zone_names[] = {
+    "buffer_read_from_file", "buffer_save",        "render",
+    "input_wait",            "mode_handle_normal", "mode_handle_insert",
+    "mode_handle_visual",    "mode_handle_search", "mode_handle_command",
+    "buffer_substitute_worker", "buffer_save_worker"};
+
+// Zones may be timed from multiple threads (e.g. substitution workers),
+// every thread keeps its own start times and the totals are added
+// atomically. Finishing a frame swaps them out atomically as well.
+static __thread uint64_t zone_start[PROFILE_ZONE_LENGTH];
+static ProfileFrame current;
+static ProfileFrame last;
+
+static uint64_t frame_start;
+static uint64_t epoch;
+static FILE *trace;
+static bool trace_first = true;
+
+static uint64_t profile_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void profile_trace_event(const char *name, uint64_t start,
+                                uint64_t end) {
+    if (trace == NULL)
+        return;
+    flockfile(trace);
+    fprintf(trace, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                   "\"pid\":1,\"tid\":%ld}",
+            trace_first ? "" : ",\n", name, (start - epoch) / 1000.0,
+            (end - start) / 1000.0, (long)syscall(SYS_gettid));
+    trace_first = false;
+    funlockfile(trace);
+}
+
+void profile_init(void) {
+    epoch = profile_now();
+    frame_start = epoch;
+    const char *path = getenv("PED_TRACE");
+    if (path == NULL)
+        return;
+    trace = fopen(path, "w");
+    if (trace != NULL) {
+        fprintf(trace, "{\"traceEvents\":[\n");
+    }
+}
+
+void profile_shutdown(void) {
+    if (trace == NULL)
+        return;
+    fprintf(trace, "\n]}\n");
+    fclose(trace);
+    trace = NULL;
+}
+
+void profile_begin(enum ProfileZone zone) { zone_start[zone] = profile_now(); }
+
+void profile_end(enum ProfileZone zone) {
+    uint64_t end = profile_now();
+    __atomic_add_fetch(&current.zone_ns[zone], end - zone_start[zone],
+                       __ATOMIC_RELAXED);
+    profile_trace_event(zone_names[zone], zone_start[zone], end);
+}
+
+void profile_frame_end(void) {
+    uint64_t end = profile_now();
+    for (int i = 0; i < PROFILE_ZONE_LENGTH; ++i) {
+        last.zone_ns[i] =
+            __atomic_exchange_n(&current.zone_ns[i], 0, __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < PROFILE_COUNTER_LENGTH; ++i) {
+        last.counters[i] =
+            __atomic_exchange_n(&current.counters[i], 0, __ATOMIC_RELAXED);
+    }
+
+    if (trace != NULL) {
+        profile_trace_event("frame", frame_start, end);
+        fprintf(trace,
+                ",\n{\"name\":\"frame\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,"
+                "\"args\":{\"allocations\":%llu,\"terminal_bytes\":%llu}}",
+                (end - epoch) / 1000.0,
+                (unsigned long long)last.counters[PROFILE_ALLOCATIONS],
+                (unsigned long long)last.counters[PROFILE_TERMINAL_BYTES]);
+    }
+    frame_start = end;
+}
+
+const ProfileFrame *profile_last_frame(void) { return &last; }
+
+void profile_format_hud(char *out, size_t size) {
+    uint64_t handlers = 0;
+    for (int i = PROFILE_MODE_NORMAL; i <= PROFILE_MODE_COMMAND; ++i) {
+        handlers += last.zone_ns[i];
+    }
+    snprintf(out, size,
+             "render %.3fms | wait %.1fms | handler %.3fms | save %.1fms | "
+             "writer %.1fms | %llu allocs | %llu bytes to terminal",
+             last.zone_ns[PROFILE_RENDER] / 1e6,
+             last.zone_ns[PROFILE_INPUT_WAIT] / 1e6, handlers / 1e6,
+             last.zone_ns[PROFILE_SAVE] / 1e6,
+             last.zone_ns[PROFILE_SAVE_WORKER] / 1e6,
+             (unsigned long long)last.counters[PROFILE_ALLOCATIONS],
+             (unsigned long long)last.counters[PROFILE_TERMINAL_BYTES]);
+}
+
+// ncurses writes the screen straight to the file descriptor of the
+// terminal, a FILE handed to newterm would never see the bytes. ped defines
+// write(2) itself instead, the calls of the ncurses library resolve to it
+// and whatever goes to the terminal is counted on the way. Other threads
+// and files (e.g. a save or the trace) are not counted.
+ssize_t write(int fd, const void *buf, size_t count) {
+    ssize_t written = syscall(SYS_write, fd, buf, count);
+    if (written > 0 && fd == STDOUT_FILENO) {
+        __atomic_add_fetch(&current.counters[PROFILE_TERMINAL_BYTES], written,
+                           __ATOMIC_RELAXED);
+    }
+    return written;
+}
+
+// Allocations are counted by linking with --wrap=malloc,calloc,realloc
+// (see Makefile.am), every call from ped's own code ends up here.
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    __atomic_add_fetch(&current.counters[PROFILE_ALLOCATIONS], 1,
+                       __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    __atomic_add_fetch(&current.counters[PROFILE_ALLOCATIONS], 1,
+                       __ATOMIC_RELAXED);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&current.counters[PROFILE_ALLOCATIONS], 1,
+                       __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+#endif // PED_PROFILE
@@ -0,0 +1,141 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Instrumentation of the hot paths, only compiled in if ped was configured
+// with --enable-profiling. Otherwise every PROFILE_* macro expands to
+// nothing.
+
+enum ProfileZone {
+    PROFILE_READ,
+    PROFILE_SAVE,
+    PROFILE_RENDER,
+    PROFILE_INPUT_WAIT,
+    // one zone per mode handler, in the same order as enum Mode
+    PROFILE_MODE_NORMAL,
+    PROFILE_MODE_INSERT,
+    PROFILE_MODE_VISUAL,
+    PROFILE_MODE_SEARCH,
+    PROFILE_MODE_COMMAND,
+    // runs on the substitution worker threads, see buffer_substitute
+    PROFILE_SUBSTITUTE_WORKER,
+    // runs on the thread of a save, see buffer_save_start
+    PROFILE_SAVE_WORKER,
+
+    // reserved zone that tells us the length of the enum
+    PROFILE_ZONE_LENGTH
+};
+
+enum ProfileCounter {
+    PROFILE_ALLOCATIONS,
+    // bytes written to the terminal, see write in profile.c
+    PROFILE_TERMINAL_BYTES,
+
+    // reserved counter that tells us the length of the enum
+    PROFILE_COUNTER_LENGTH
+};
+
+typedef struct _ProfileFrame_ {
+    // nanoseconds spent inside of each zone
+    uint64_t zone_ns[PROFILE_ZONE_LENGTH];
+    uint64_t counters[PROFILE_COUNTER_LENGTH];
+} ProfileFrame;
+
+#ifdef PED_PROFILE
+
+#define PROFILE_INIT() profile_init()
+#define PROFILE_SHUTDOWN() profile_shutdown()
+#define PROFILE_BEGIN(zone) profile_begin(zone)
+#define PROFILE_END(zone) profile_end(zone)
+#define PROFILE_FRAME_END() profile_frame_end()
+
+/**
+ *  profile_init()
+ *
+ *  Purpose:
+ *      This function starts profiling. If the environment variable
+ *      PED_TRACE is set, every zone and frame is written to the file it
+ *      names in Chrome's trace event format (load it in chrome://tracing
+ *      or ui.perfetto.dev).
+ *  Return value:
+ *      void
+ */
+void profile_init(void);
+
+/**
+ *  profile_shutdown()
+ *
+ *  Purpose:
+ *      This function finishes and closes the trace file.
+ *  Return value:
+ *      void
+ */
+void profile_shutdown(void);
+
+/**
+ *  profile_begin(zone)
+ *
+ *  Purpose:
+ *      This function starts timing 'zone' on the calling thread.
+ *  Return value:
+ *      void
+ */
+void profile_begin(enum ProfileZone zone);
+
+/**
+ *  profile_end(zone)
+ *
+ *  Purpose:
+ *      This function stops timing 'zone' on the calling thread, adds the
+ *      time to the current frame and writes a trace event.
+ *  Return value:
+ *      void
+ */
+void profile_end(enum ProfileZone zone);
+
+/**
+ *  profile_frame_end()
+ *
+ *  Purpose:
+ *      This function finishes the current frame, its statistics are
+ *      available through profile_last_frame afterwards.
+ *  Return value:
+ *      void
+ */
+void profile_frame_end(void);
+
+/**
+ *  profile_last_frame()
+ *
+ *  Purpose:
+ *      This function returns the statistics of the last finished frame.
+ *  Return value:
+ *      const ProfileFrame* - the last frame
+ */
+const ProfileFrame *profile_last_frame(void);
+
+/**
+ *  profile_format_hud(out, size)
+ *
+ *  Purpose:
+ *      This function formats the statistics of the last frame into a
+ *      single line that fits the infobar.
+ *  Return value:
+ *      void
+ */
+void profile_format_hud(char *out, size_t size);
+
+#else
+
+#define PROFILE_INIT()
+#define PROFILE_SHUTDOWN()
+#define PROFILE_BEGIN(zone)
+#define PROFILE_END(zone)
+#define PROFILE_FRAME_END()
+
+#endif // PED_PROFILE
+
+#endif // _PROFILE_H_
@@ -0,0 +1,193 @@
+#include "script.h"
+
+#include <ncurses.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mode.h"
+#include "utf8.h"
+
+static const struct {
+    const char *name;
+    wint_t key;
+} script_key_names[] = {
+    {"Esc", KEY_ESCAPE},     {"CR", KEY_ENTER1},       {"Enter", KEY_ENTER1},
+    {"Tab", KEY_TAB},        {"BS", KEY_BACKSPACE},    {"Del", KEY_DC},
+    {"Up", KEY_UP},          {"Down", KEY_DOWN},       {"Left", KEY_LEFT},
+    {"Right", KEY_RIGHT},    {"Home", KEY_HOME},       {"End", KEY_END},
+    {"lt", '<'},
+};
+
+static size_t script_parse_key(const char *str, size_t len, wint_t *key) {
+    if (str[0] == '<') {
+        const char *end = memchr(str, '>', len < 16 ? len : 16);
+        size_t name_len = end != NULL ? end - str - 1 : 0;
+        if (name_len == 3 && (str[1] == 'C' || str[1] == 'c') &&
+            str[2] == '-') {
+            *key = CTRL(str[3]);
+            return 5;
+        }
+        for (size_t i = 0;
+             i < sizeof(script_key_names) / sizeof(script_key_names[0]);
+             ++i) {
+            if (strlen(script_key_names[i].name) == name_len &&
+                strncasecmp(str + 1, script_key_names[i].name, name_len) ==
+                    0) {
+                *key = script_key_names[i].key;
+                return name_len + 2;
+            }
+        }
+        // Not a known key, the '<' is just typed
+    }
+    return utf8_decode(str, len, key);
+}
+
+bool script_read(Script *script, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open script: %s\n", path);
+        return false;
+    }
+
+    size_t len = 0;
+    size_t cap = 4096;
+    char *data = malloc(cap);
+    while (data != NULL) {
+        len += fread(data + len, 1, cap - len, fp);
+        if (len < cap)
+            break;
+        cap *= 2;
+        char *tmp = realloc(data, cap);
+        if (tmp == NULL) {
+            free(data);
+        }
+        data = tmp;
+    }
+    fclose(fp);
+
+    // Every key takes up at least one byte
+    script->size = 0;
+    script->keys = data != NULL ? malloc(len * sizeof(wint_t) + 1) : NULL;
+    if (script->keys == NULL) {
+        free(data);
+        fprintf(stderr, "Failed to allocate space for script.\n");
+        return false;
+    }
+    for (size_t i = 0; i < len;) {
+        i += script_parse_key(data + i, len - i, &script->keys[script->size]);
+        script->size++;
+    }
+    free(data);
+    return true;
+}
+
+void script_free(Script *script) {
+    if (script == NULL)
+        return;
+    free(script->keys);
+    script->keys = NULL;
+    script->size = 0;
+}
+
+static enum ScriptResult script_run_file(const Script *script, char *path) {
+    // buffer_read_from_file would create missing files
+    if (access(path, F_OK) != 0) {
+        fprintf(stderr, "%s: No such file\n", path);
+        return SCRIPT_FAILED;
+    }
+
+    Buffer buf = {0};
+    State state = {0};
+    state.headless = true;
+    state.max_mem = BUFFER_DEFAULT_MAX_MEM;
+    state.max_y = SCRIPT_SCREEN_HEIGHT;
+    state.max_x = SCRIPT_SCREEN_WIDTH;
+    buf.state = &state;
+    if (!buffer_read_from_file(&buf, path)) {
+        buffer_free(&buf);
+        return SCRIPT_FAILED;
+    }
+
+    enum ScriptResult result = SCRIPT_UNCHANGED;
+    for (size_t i = 0; i < script->size; ++i) {
+        wint_t c = script->keys[i];
+        if (c == CTRL('q'))
+            break;
+
+        enum Mode mode = state.current_mode;
+        bool close_requested = mode_funcs[mode](&buf, &state, c);
+        if (state.message != NULL) {
+            fprintf(stderr, "%s: %s\n", path, state.message);
+            state.message = NULL;
+        }
+        if (close_requested) {
+            result = SCRIPT_SAVED;
+            break;
+        }
+        // A Ctrl+s may also be the argument of a pending key (e.g. 'f')
+        if (state.save_failed) {
+            result = SCRIPT_FAILED;
+            break;
+        }
+    }
+    buffer_free(&buf);
+    return result;
+}
+
+static void *script_worker(void *arg) {
+    ScriptRun *run = arg;
+    size_t i;
+    while ((i = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) <
+           run->count) {
+        enum ScriptResult result = script_run_file(run->script, run->files[i]);
+        __atomic_add_fetch(&run->results[result], 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+int script_run(const char *path, char **files, size_t count) {
+    Script script = {0};
+    if (!script_read(&script, path))
+        return 1;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = cpus > 1 ? cpus : 1;
+    if (threads > count) {
+        threads = count;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The calling thread is one of the workers, if a thread can not be
+    // started the others just handle more files
+    ScriptRun run = {.script = &script, .files = files, .count = count};
+    pthread_t ids[threads];
+    bool started[threads];
+    for (size_t t = 1; t < threads; ++t) {
+        started[t] = pthread_create(&ids[t], NULL, script_worker, &run) == 0;
+    }
+    script_worker(&run);
+    for (size_t t = 1; t < threads; ++t) {
+        if (started[t]) {
+            pthread_join(ids[t], NULL);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds =
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%zu files in %.3fs (%.1f files/s, %zu threads): %zu saved, "
+           "%zu unchanged, %zu failed\n",
+           count, seconds, seconds > 0 ? count / seconds : 0.0, threads,
+           run.results[SCRIPT_SAVED], run.results[SCRIPT_UNCHANGED],
+           run.results[SCRIPT_FAILED]);
+
+    script_free(&script);
+    return run.results[SCRIPT_FAILED] > 0 ? 1 : 0;
+}
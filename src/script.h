@@ -0,0 +1,111 @@
+#ifndef _SCRIPT_H_
+#define _SCRIPT_H_
+
+#include "buffer.h"
+#include "defs.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <wchar.h>
+
+// Size of the screen that scripts are run with, keys like Ctrl+d depend on it
+#define SCRIPT_SCREEN_HEIGHT 22
+#define SCRIPT_SCREEN_WIDTH 80
+
+// Keys of a script, decoded once and shared by every worker
+typedef struct _Script_ {
+    wint_t *keys;
+    size_t size;
+} Script;
+
+enum ScriptResult { SCRIPT_SAVED, SCRIPT_UNCHANGED, SCRIPT_FAILED };
+
+// A script being run on a list of files by multiple threads. Workers take
+// the next file by incrementing 'next', results are counted atomically.
+typedef struct _ScriptRun_ {
+    const Script *script;
+    char **files;
+    size_t count;
+
+    size_t next;
+    size_t results[SCRIPT_FAILED + 1];
+} ScriptRun;
+
+/**
+ *  script_read(script, path)
+ *
+ *  Purpose:
+ *      This function reads the keys of the script at 'path'. Every
+ *      character of the file is one key, just as if it was typed (a \n is
+ *      Enter). Special keys are written in angle brackets: <Esc>, <CR>,
+ *      <Tab>, <BS>, <Del>, <Up>, <Down>, <Left>, <Right>, <Home>, <End>,
+ *      <lt> (a literal '<') and <C-x> for Ctrl+x. Note that this function
+ *      is using fprintf to print an error if occoured.
+ *  Return value:
+ *      true - Reading was successful
+ *      false - Reading was not successful
+ */
+bool script_read(Script *script, const char *path);
+
+/**
+ *  script_free(script)
+ *
+ *  Purpose:
+ *      This function free's all of the memory allocated by script_read.
+ *  Return value:
+ *      void
+ */
+void script_free(Script *script);
+
+/**
+ *  script_parse_key(str, len, key)
+ *
+ *  Purpose:
+ *      This function decodes the key at the start of the first 'len' bytes
+ *      of 'str' into 'key', see script_read for the notation.
+ *  Return value:
+ *      size_t - amount of bytes the key takes up
+ */
+static size_t script_parse_key(const char *str, size_t len, wint_t *key);
+
+/**
+ *  script_run_file(script, path)
+ *
+ *  Purpose:
+ *      This function reads the file at 'path' into a new buffer and passes
+ *      the keys of 'script' to the handler of the current mode, without a
+ *      terminal. The script ends once it is done, Ctrl+q is pressed or a
+ *      handler closes the editor (Ctrl+s saves and closes). Messages of
+ *      the handlers are printed to stderr.
+ *  Return value:
+ *      SCRIPT_SAVED - The file was saved
+ *      SCRIPT_UNCHANGED - The script ended without saving
+ *      SCRIPT_FAILED - The file could not be read or saved
+ */
+static enum ScriptResult script_run_file(const Script *script, char *path);
+
+/**
+ *  script_worker(arg)
+ *
+ *  Purpose:
+ *      Thread entry point of script_run, 'arg' is the ScriptRun. Files are
+ *      taken from the list until every file has been handled.
+ *  Return value:
+ *      NULL
+ */
+static void *script_worker(void *arg);
+
+/**
+ *  script_run(path, files, count)
+ *
+ *  Purpose:
+ *      This function runs the script at 'path' on each of the 'count'
+ *      'files' (headless mode, 'ped -s script file...'). The files are
+ *      split across one thread per CPU. A summary including the throughput
+ *      in files/s is printed once all files are done.
+ *  Return value:
+ *      0 - Every file was handled
+ *      1 - The script or at least one file failed
+ */
+int script_run(const char *path, char **files, size_t count);
+
+#endif // _SCRIPT_H_
@@ -0,0 +1,147 @@
+#include "utf8.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+size_t utf8_decode(const char *str, size_t len, wint_t *c) {
+    if (len == 0)
+        return 0;
+
+    const unsigned char *s = (const unsigned char *)str;
+    if (s[0] < 0x80) {
+        *c = s[0];
+        return 1;
+    }
+
+    // The lead byte tells the length of the sequence and limits the range
+    // of the second byte, which rules out overlong encodings, surrogates
+    // and characters above U+10FFFF
+    size_t n;
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xBF;
+    wint_t value;
+    if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+        n = 2;
+        value = s[0] & 0x1F;
+    } else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+        n = 3;
+        value = s[0] & 0x0F;
+        if (s[0] == 0xE0) {
+            lo = 0xA0;
+        } else if (s[0] == 0xED) {
+            hi = 0x9F;
+        }
+    } else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+        n = 4;
+        value = s[0] & 0x07;
+        if (s[0] == 0xF0) {
+            lo = 0x90;
+        } else if (s[0] == 0xF4) {
+            hi = 0x8F;
+        }
+    } else {
+        *c = UTF8_REPLACEMENT;
+        return 1;
+    }
+
+    if (len < n || s[1] < lo || s[1] > hi) {
+        *c = UTF8_REPLACEMENT;
+        return 1;
+    }
+    for (size_t i = 1; i < n; ++i) {
+        if ((s[i] & 0xC0) != 0x80) {
+            *c = UTF8_REPLACEMENT;
+            return 1;
+        }
+        value = (value << 6) | (s[i] & 0x3F);
+    }
+    *c = value;
+    return n;
+}
+
+size_t utf8_encode(wint_t c, char *out) {
+    if (c < 0x80) {
+        out[0] = c;
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = 0xC0 | (c >> 6);
+        out[1] = 0x80 | (c & 0x3F);
+        return 2;
+    }
+    if (c >= 0xD800 && c <= 0xDFFF) {
+        c = UTF8_REPLACEMENT;
+    }
+    if (c < 0x10000) {
+        out[0] = 0xE0 | (c >> 12);
+        out[1] = 0x80 | ((c >> 6) & 0x3F);
+        out[2] = 0x80 | (c & 0x3F);
+        return 3;
+    }
+    if (c < 0x110000) {
+        out[0] = 0xF0 | (c >> 18);
+        out[1] = 0x80 | ((c >> 12) & 0x3F);
+        out[2] = 0x80 | ((c >> 6) & 0x3F);
+        out[3] = 0x80 | (c & 0x3F);
+        return 4;
+    }
+    return utf8_encode(UTF8_REPLACEMENT, out);
+}
+
+size_t utf8_prev(const char *str, size_t offset) {
+    const unsigned char *s = (const unsigned char *)str;
+
+    // Walk back over at most three continuation bytes, the byte in front of
+    // them only starts the previous character if it decodes to exactly
+    // that many bytes. Otherwise the last byte was decoded on its own.
+    for (size_t n = 1; n <= UTF8_MAX_BYTES && n <= offset; ++n) {
+        unsigned char b = s[offset - n];
+        if ((b & 0xC0) == 0x80)
+            continue;
+        wint_t c;
+        if (n > 1 && utf8_decode(str + offset - n, n, &c) == n)
+            return offset - n;
+        break;
+    }
+    return offset - 1;
+}
+
+size_t utf8_length(const char *str, size_t len) {
+    // Most text is ASCII, check 8 bytes at once for a set high bit before
+    // decoding anything
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, str + i, sizeof(word));
+        if (word & 0x8080808080808080ULL)
+            break;
+    }
+    for (; i < len && (unsigned char)str[i] < 0x80; ++i)
+        ;
+    if (i == len)
+        return len;
+
+    size_t count = i;
+    wint_t c;
+    while (i < len) {
+        i += utf8_decode(str + i, len - i, &c);
+        count++;
+    }
+    return count;
+}
+
+char *utf8_from_wcs(const wchar_t *str, size_t *len) {
+    size_t n = wcslen(str);
+    char *out = malloc(n * UTF8_MAX_BYTES + 1);
+    if (out == NULL)
+        return NULL;
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; ++i) {
+        bytes += utf8_encode(str[i], out + bytes);
+    }
+    out[bytes] = '\0';
+    *len = bytes;
+    return out;
+}
@@ -0,0 +1,74 @@
+#ifndef _UTF8_H_
+#define _UTF8_H_
+
+#include <stddef.h>
+#include <wchar.h>
+
+// Largest amount of bytes a single character takes up
+#define UTF8_MAX_BYTES 4
+// Invalid bytes are decoded to this character
+#define UTF8_REPLACEMENT 0xFFFD
+
+/**
+ *  utf8_decode(str, len, c)
+ *
+ *  Purpose:
+ *      This function decodes the character at the start of the first 'len'
+ *      bytes of 'str' into 'c'. A byte that does not start a valid sequence
+ *      (including overlong encodings and surrogates) is decoded on its own
+ *      as UTF8_REPLACEMENT, so every byte belongs to exactly one character.
+ *  Return value:
+ *      size_t - amount of bytes the character takes up, 0 if 'len' is 0
+ */
+size_t utf8_decode(const char *str, size_t len, wint_t *c);
+
+/**
+ *  utf8_encode(c, out)
+ *
+ *  Purpose:
+ *      This function encodes the character 'c' into 'out', which needs to
+ *      hold at least UTF8_MAX_BYTES bytes. Characters that can not be
+ *      encoded are written as UTF8_REPLACEMENT.
+ *  Return value:
+ *      size_t - amount of bytes written
+ */
+size_t utf8_encode(wint_t c, char *out);
+
+/**
+ *  utf8_prev(str, offset)
+ *
+ *  Purpose:
+ *      This function finds the start of the character in front of the byte
+ *      'offset' of 'str', stepping over characters the same way utf8_decode
+ *      does. 'offset' needs to be at the start of a character and above 0.
+ *  Return value:
+ *      size_t - offset of the previous character
+ */
+size_t utf8_prev(const char *str, size_t offset);
+
+/**
+ *  utf8_length(str, len)
+ *
+ *  Purpose:
+ *      This function counts the characters inside of the first 'len' bytes
+ *      of 'str'. Text without any multibyte character is counted without
+ *      decoding it.
+ *  Return value:
+ *      size_t - amount of characters
+ */
+size_t utf8_length(const char *str, size_t len);
+
+/**
+ *  utf8_from_wcs(str, len)
+ *
+ *  Purpose:
+ *      This function encodes the wide character string 'str' into a newly
+ *      allocated, \0 terminated UTF-8 string. Its length in bytes is
+ *      stored in 'len'.
+ *  Return value:
+ *      NULL - Allocation failed
+ *      char* - the encoded string, needs to be free'd by the caller
+ */
+char *utf8_from_wcs(const wchar_t *str, size_t *len);
+
+#endif // _UTF8_H_
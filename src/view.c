@@ -0,0 +1,445 @@
+#include "view.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+View *view_new(Buffer *buf) {
+    if (buf == NULL)
+        return NULL;
+
+    View *view = calloc(1, sizeof(View));
+    if (view == NULL)
+        return NULL;
+    view->buf = buf;
+    view->cursor_x = buf->cursor_x;
+    view->cursor_y = buf->cursor_y;
+    view->render_cursor_x = buf->render_cursor_x;
+    view->scroll_y = buf->scroll_y;
+    // The additional cursors stay with the view they were added in
+    return view;
+}
+
+void view_free(View *view) {
+    if (view == NULL)
+        return;
+
+    gutter_free(&view->gutter);
+    if (view->line_win != NULL) {
+        delwin(view->line_win);
+    }
+    if (view->text_win != NULL) {
+        delwin(view->text_win);
+    }
+    if (view->border_win != NULL) {
+        delwin(view->border_win);
+    }
+    if (view->status_win != NULL) {
+        delwin(view->status_win);
+    }
+    free(view->cursors);
+    free(view);
+}
+
+void view_load(View *view) {
+    if (view == NULL)
+        return;
+
+    Buffer *buf = view->buf;
+    buf->cursor_x = view->cursor_x;
+    buf->cursor_y = view->cursor_y;
+    buf->render_cursor_x = view->render_cursor_x;
+    buf->scroll_y = view->scroll_y;
+    buf->cursors = view->cursors;
+    buf->cursor_count = view->cursor_count;
+    buf->cursor_cap = view->cursor_cap;
+
+    // Another view might have deleted lines or characters since this one
+    // was stored
+    buffer_clamp_cursor(buf);
+    if (buf->scroll_y > buf->cursor_y) {
+        buf->scroll_y = buf->cursor_y;
+    }
+    if (buf->cursor_count > 0 &&
+        buf->cursors[buf->cursor_count - 1].y >= buf->size) {
+        // The multi cursor functions clamp every cursor on their own, only
+        // cursors behind the last line would be drawn at the wrong place
+        while (buf->cursor_count > 0 &&
+               buf->cursors[buf->cursor_count - 1].y >= buf->size) {
+            buf->cursor_count--;
+        }
+    }
+}
+
+void view_store(View *view) {
+    if (view == NULL)
+        return;
+
+    Buffer *buf = view->buf;
+    view->cursor_x = buf->cursor_x;
+    view->cursor_y = buf->cursor_y;
+    view->render_cursor_x = buf->render_cursor_x;
+    view->scroll_y = buf->scroll_y;
+    view->cursors = buf->cursors;
+    view->cursor_count = buf->cursor_count;
+    view->cursor_cap = buf->cursor_cap;
+}
+
+static void view_place(View *view) {
+    size_t height = view->height - view->status;
+    size_t text_x = view->x + view->gutter.width;
+    size_t text_width = view->width - view->border - view->gutter.width;
+    if (view->text_win != NULL &&
+        (size_t)getbegy(view->text_win) == view->y &&
+        (size_t)getbegx(view->text_win) == text_x &&
+        (size_t)getmaxy(view->text_win) == height &&
+        (size_t)getmaxx(view->text_win) == text_width &&
+        (view->border_win != NULL) == view->border &&
+        (view->status_win != NULL) == view->status)
+        return;
+
+    // Moving a window with mvwin fails as soon as a single cell of it
+    // would leave the screen, so the windows are simply created again
+    if (view->line_win != NULL) {
+        delwin(view->line_win);
+        delwin(view->text_win);
+    }
+    if (view->border_win != NULL) {
+        delwin(view->border_win);
+        view->border_win = NULL;
+    }
+    if (view->status_win != NULL) {
+        delwin(view->status_win);
+        view->status_win = NULL;
+    }
+    view->line_win = newwin(height, view->gutter.width, view->y, view->x);
+    view->text_win = newwin(height, text_width, view->y, text_x);
+    keypad(view->text_win, TRUE);
+    if (view->border) {
+        view->border_win =
+            newwin(height, 1, view->y, view->x + view->width - 1);
+    }
+    if (view->status) {
+        view->status_win =
+            newwin(1, view->width, view->y + view->height - 1, view->x);
+    }
+    gutter_invalidate(&view->gutter);
+}
+
+void view_draw(View *view, State *state, bool focused) {
+    if (view == NULL || state == NULL)
+        return;
+
+    wchar_t segment[SEGMENT_SIZE];
+    // columns of the additional cursors inside of 'segment'
+    size_t marks[SEGMENT_SIZE];
+    Buffer *buf = view->buf;
+    size_t height = view->height - view->status;
+    gutter_layout(&view->gutter, buf->size, height, state->relative_numbers);
+    view_place(view);
+    WINDOW *line_win = view->line_win;
+    WINDOW *text_win = view->text_win;
+    // The gutter is not erased, its rows are only drawn once they change
+    werase(text_win);
+
+    // Only the lines that are on the screen are being looked at
+    size_t text_width = view->width - view->border - view->gutter.width;
+    if (state->wrap) {
+        buffer_scroll_wrapped(buf, text_width);
+    } else {
+        buffer_scroll_to_cursor(buf);
+    }
+
+    size_t cursor_row = buf->cursor_y - buf->scroll_y;
+    size_t cursor_col = buf->render_cursor_x;
+    // The terminal only shows the primary cursor, additional cursors are
+    // drawn reversed. They are sorted, so the next one to draw is always
+    // the next one in the list.
+    size_t next_cursor = buffer_find_cursor(buf, 0, buf->scroll_y);
+    bool visual = focused && state->current_mode == MODE_VISUAL;
+    size_t visual_first =
+        buf->cursor_y < state->visual_y ? buf->cursor_y : state->visual_y;
+    size_t visual_last =
+        buf->cursor_y < state->visual_y ? state->visual_y : buf->cursor_y;
+    Line *itr = buffer_find_line(buf, buf->scroll_y);
+    size_t y = 0;
+    for (size_t i = buf->scroll_y; itr != NULL && y < height;
+         ++i, itr = itr->next) {
+        buffer_touch_line(buf, itr);
+        gutter_draw_row(&view->gutter, line_win, y,
+                        gutter_number(&view->gutter, i, buf->cursor_y));
+        bool selected = visual && i >= visual_first && i <= visual_last;
+        wattrset(text_win, selected ? A_REVERSE : A_NORMAL);
+
+        size_t rows = state->wrap ? line_wrap(itr, text_width) : 1;
+        size_t offset = 0;
+        size_t k = 0;
+        for (size_t r = 0; r < rows && y < height; ++r, ++y) {
+            if (r > 0) {
+                gutter_draw_row(&view->gutter, line_win, y, 0);
+            }
+            size_t end = r + 1 < rows ? itr->wrap_points[r + 1] : itr->size;
+            // Every row is collected into 'segment' and drawn at once,
+            // ncurses then only needs to move to the row one time
+            size_t j = 0;
+            size_t start = 0;
+            size_t n = 0;
+            size_t m = 0;
+            for (; k < end && offset < itr->bytes; ++k) {
+                wint_t ch;
+                size_t len =
+                    utf8_decode(itr->data + offset, itr->bytes - offset, &ch);
+                int width = character_width(ch);
+                if (j + width > text_width)
+                    break;
+                if (state->wrap && i == buf->cursor_y && k == buf->cursor_x) {
+                    cursor_row = y;
+                    cursor_col = j;
+                }
+                if (next_cursor < buf->cursor_count &&
+                    buf->cursors[next_cursor].y == i &&
+                    buf->cursors[next_cursor].x == k) {
+                    marks[m++] = j;
+                    next_cursor++;
+                }
+                // ncurses would draw e.g. a tab as multiple columns,
+                // character_width says it is just one column wide
+                segment[n++] = wcwidth(ch) < 0 ? L' ' : ch;
+                j += width;
+                offset += len;
+                if (n == SEGMENT_SIZE) {
+                    mvwaddnwstr(text_win, y, start, segment, n);
+                    for (size_t l = 0; l < m; ++l) {
+                        mvwchgat(text_win, y, marks[l], 1, A_REVERSE, 0, NULL);
+                    }
+                    start = j;
+                    n = 0;
+                    m = 0;
+                }
+            }
+            if (n > 0) {
+                mvwaddnwstr(text_win, y, start, segment, n);
+                for (size_t l = 0; l < m; ++l) {
+                    mvwchgat(text_win, y, marks[l], 1, A_REVERSE, 0, NULL);
+                }
+            }
+            if (state->wrap && i == buf->cursor_y &&
+                buf->cursor_x >= itr->size && r + 1 == rows) {
+                cursor_row = y;
+                cursor_col = j;
+            }
+            // A cursor on an empty line
+            if (r + 1 == rows && j < text_width &&
+                next_cursor < buf->cursor_count &&
+                buf->cursors[next_cursor].y == i &&
+                buf->cursors[next_cursor].x >= itr->size) {
+                mvwchgat(text_win, y, j, 1, A_REVERSE, 0, NULL);
+            }
+        }
+        // Cursors that are not on the screen (behind the window's edge)
+        while (next_cursor < buf->cursor_count &&
+               buf->cursors[next_cursor].y <= i) {
+            next_cursor++;
+        }
+    }
+    wattrset(text_win, A_NORMAL);
+    for (; y < height; ++y) {
+        gutter_draw_row(&view->gutter, line_win, y, 0);
+    }
+
+    gutter_refresh(&view->gutter, line_win);
+    if (view->border_win != NULL) {
+        mvwvline(view->border_win, 0, 0, ACS_VLINE, height);
+        wnoutrefresh(view->border_win);
+    }
+    if (view->status_win != NULL) {
+        wbkgdset(view->status_win, focused ? A_REVERSE | A_BOLD : A_REVERSE);
+        werase(view->status_win);
+        // The last column is left out, writing it would wrap the cursor
+        mvwaddnstr(view->status_win, 0, 0, buf->file_path, view->width - 1);
+        wnoutrefresh(view->status_win);
+    }
+    wmove(text_win, cursor_row, cursor_col);
+    wnoutrefresh(text_win);
+}
+
+Split *split_new(View *view) {
+    Split *node = calloc(1, sizeof(Split));
+    if (node == NULL)
+        return NULL;
+    node->view = view;
+    return node;
+}
+
+static Split *split_find(Split *node, View *view) {
+    if (node == NULL)
+        return NULL;
+    if (node->view != NULL)
+        return node->view == view ? node : NULL;
+
+    Split *found = split_find(node->first, view);
+    return found != NULL ? found : split_find(node->second, view);
+}
+
+static View *split_find_buffer(Split *node, Buffer *buf) {
+    if (node == NULL)
+        return NULL;
+    if (node->view != NULL)
+        return node->view->buf == buf ? node->view : NULL;
+
+    View *found = split_find_buffer(node->first, buf);
+    return found != NULL ? found : split_find_buffer(node->second, buf);
+}
+
+bool view_can_split(View *view, bool vertical) {
+    if (view == NULL)
+        return false;
+    return vertical ? view->width / 2 >= VIEW_MIN_WIDTH
+                    : view->height / 2 >= VIEW_MIN_HEIGHT;
+}
+
+bool split_view(Split *root, View *view, View *new_view, bool vertical) {
+    Split *node = split_find(root, view);
+    if (node == NULL || new_view == NULL || !view_can_split(view, vertical))
+        return false;
+
+    // The node keeps its place in the tree and becomes the parent of the
+    // old and the new view
+    Split *first = split_new(view);
+    Split *second = split_new(new_view);
+    if (first == NULL || second == NULL) {
+        free(first);
+        free(second);
+        return false;
+    }
+    first->parent = node;
+    second->parent = node;
+    node->view = NULL;
+    node->vertical = vertical;
+    node->first = first;
+    node->second = second;
+    return true;
+}
+
+View *split_close(Split **root, View *view) {
+    Split *node = split_find(*root, view);
+    if (node == NULL)
+        return NULL;
+
+    Buffer *buf = view->buf;
+    view_store(view);
+    // The cursors belong to the view, they are free'd together with it
+    buf->cursors = NULL;
+    buf->cursor_count = 0;
+    buf->cursor_cap = 0;
+
+    View *next = NULL;
+    Split *parent = node->parent;
+    if (parent == NULL) {
+        *root = NULL;
+    } else {
+        // The sibling takes the place of the parent in the tree
+        bool first = parent->first == node;
+        Split *sibling = first ? parent->second : parent->first;
+        parent->view = sibling->view;
+        parent->vertical = sibling->vertical;
+        parent->first = sibling->first;
+        parent->second = sibling->second;
+        if (parent->first != NULL) {
+            parent->first->parent = parent;
+            parent->second->parent = parent;
+        }
+        free(sibling);
+
+        // Focus the view of the sibling that was closest to the closed one
+        Split *itr = parent;
+        while (itr->view == NULL) {
+            itr = first ? itr->first : itr->second;
+        }
+        next = itr->view;
+    }
+    free(node);
+    view_free(view);
+
+    split_free_buffer(*root, buf);
+    return next;
+}
+
+void split_free_buffer(Split *root, Buffer *buf) {
+    if (buf == NULL || split_find_buffer(root, buf) != NULL)
+        return;
+    free(buf->file_path);
+    buffer_free(buf);
+    free(buf);
+}
+
+void split_layout(Split *node, size_t y, size_t x, size_t height,
+                  size_t width, bool status) {
+    if (node == NULL)
+        return;
+
+    if (node->view != NULL) {
+        View *view = node->view;
+        view->y = y;
+        view->x = x;
+        view->height = height;
+        view->width = width;
+        view->status = status;
+        // The view on the right edge of the screen does not need a border
+        view->border = (size_t)COLS > x + width;
+        return;
+    }
+    if (node->vertical) {
+        size_t first = width / 2;
+        split_layout(node->first, y, x, height, first, status);
+        split_layout(node->second, y, x + first, height, width - first,
+                     status);
+    } else {
+        size_t first = height / 2;
+        split_layout(node->first, y, x, first, width, status);
+        split_layout(node->second, y + first, x, height - first, width,
+                     status);
+    }
+}
+
+size_t split_views(Split *node, View **views, size_t max) {
+    if (node == NULL || max == 0)
+        return 0;
+    if (node->view != NULL) {
+        views[0] = node->view;
+        return 1;
+    }
+
+    size_t count = split_views(node->first, views, max);
+    return count + split_views(node->second, views + count, max - count);
+}
+
+Buffer *split_open_buffer(Split *root, const char *path, State *state) {
+    if (path == NULL || state == NULL)
+        return NULL;
+
+    View *views[VIEW_MAX];
+    size_t count = split_views(root, views, VIEW_MAX);
+    for (size_t i = 0; i < count; ++i) {
+        if (strcmp(views[i]->buf->file_path, path) == 0)
+            return views[i]->buf;
+    }
+
+    Buffer *buf = calloc(1, sizeof(Buffer));
+    char *file_path = strdup(path);
+    if (buf == NULL || file_path == NULL) {
+        free(buf);
+        free(file_path);
+        printf("Failed to allocate space for buffer.\n");
+        return NULL;
+    }
+    buf->state = state;
+    if (!buffer_read_from_file(buf, file_path)) {
+        buffer_free(buf);
+        free(buf);
+        free(file_path);
+        return NULL;
+    }
+    return buf;
+}
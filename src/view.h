@@ -0,0 +1,255 @@
+#ifndef _VIEW_H_
+#define _VIEW_H_
+
+#include "buffer.h"
+#include "defs.h"
+#include "gutter.h"
+#include <ncurses.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// maximum amount of characters drawn by a single call to mvwaddnwstr
+#define SEGMENT_SIZE 256
+// maximum amount of views on the screen
+#define VIEW_MAX 32
+// views are not split if the new views would be smaller than this
+#define VIEW_MIN_HEIGHT 4
+#define VIEW_MIN_WIDTH 16
+
+// A window showing a buffer. Multiple views may show the same buffer, its
+// lines and everything cached inside of them (e.g. the wrap points) are
+// shared, a second view of a huge file costs no more than the view itself.
+// Only the cursors and the scroll position belong to the view. The buffer
+// holds those of the view that is being worked with, they are swapped in
+// and out with view_load and view_store.
+typedef struct _View_ {
+    Buffer *buf;
+
+    size_t cursor_x;
+    size_t cursor_y;
+    size_t render_cursor_x;
+    size_t scroll_y;
+    Cursor *cursors;
+    size_t cursor_count;
+    size_t cursor_cap;
+
+    // Area of the screen, including the gutter, the border on the right
+    // (if there is a view next to it) and the status line at the bottom
+    // (if there is more than one view)
+    size_t y;
+    size_t x;
+    size_t height;
+    size_t width;
+    bool border;
+    bool status;
+
+    WINDOW *line_win;
+    WINDOW *text_win;
+    WINDOW *border_win;
+    WINDOW *status_win;
+    Gutter gutter;
+} View;
+
+// The views on the screen are the leaves of a tree. Every other node is
+// split into two halves, 'first' is left of 'second' if the split is
+// 'vertical' and above it otherwise.
+typedef struct _Split_ {
+    // NULL if the node is split
+    View *view;
+    bool vertical;
+    struct _Split_ *first;
+    struct _Split_ *second;
+    struct _Split_ *parent;
+} Split;
+
+/**
+ *  view_new(buf)
+ *
+ *  Purpose:
+ *      This function allocates a new view of 'buf', which starts at the
+ *      cursor and scroll position that is currently stored in 'buf'.
+ *  Return value:
+ *      NULL - Allocation failed
+ *      View* - the newly allocated view
+ */
+View *view_new(Buffer *buf);
+
+/**
+ *  view_free(view)
+ *
+ *  Purpose:
+ *      This function free's the view 'view' and its windows, the buffer
+ *      is left untouched.
+ *  Return value:
+ *      void
+ */
+void view_free(View *view);
+
+/**
+ *  view_load(view)
+ *
+ *  Purpose:
+ *      This function moves the cursors and the scroll position of 'view'
+ *      into its buffer, every buffer_* function then works with them.
+ *  Return value:
+ *      void
+ */
+void view_load(View *view);
+
+/**
+ *  view_store(view)
+ *
+ *  Purpose:
+ *      This function takes the cursors and the scroll position back from
+ *      the buffer of 'view', which needs to be loaded (see view_load).
+ *  Return value:
+ *      void
+ */
+void view_store(View *view);
+
+/**
+ *  view_draw(view, state, focused)
+ *
+ *  Purpose:
+ *      This function draws the lines of the buffer that are visible in
+ *      'view', which needs to be loaded. The windows of the view are
+ *      created or moved if its area changed and marked for the next
+ *      doupdate. The cursor of the text window is moved to the primary
+ *      cursor, the selection of visual mode is only shown if 'focused'.
+ *  Return value:
+ *      void
+ */
+void view_draw(View *view, State *state, bool focused);
+
+/**
+ *  view_can_split(view, vertical)
+ *
+ *  Purpose:
+ *      This function checks whether both halves of 'view' would be large
+ *      enough if it was split ('vertical' see split_view).
+ *  Return value:
+ *      true - 'view' can be split
+ *      false - at least one half would be too small
+ */
+bool view_can_split(View *view, bool vertical);
+
+/**
+ *  view_place(view)
+ *
+ *  Purpose:
+ *      This function (re)creates the windows of 'view' if they do not
+ *      match the area of the view or the width of its gutter anymore.
+ *  Return value:
+ *      void
+ */
+static void view_place(View *view);
+
+/**
+ *  split_new(view)
+ *
+ *  Purpose:
+ *      This function allocates a layout consisting of 'view' only.
+ *  Return value:
+ *      NULL - Allocation failed
+ *      Split* - the root of the new layout
+ */
+Split *split_new(View *view);
+
+/**
+ *  split_view(root, view, new_view, vertical)
+ *
+ *  Purpose:
+ *      This function splits the area of 'view' in half, 'new_view' is
+ *      placed right of it if 'vertical' is set and below it otherwise.
+ *  Return value:
+ *      true - 'new_view' is part of the layout
+ *      false - 'view' is too small or allocation failed
+ */
+bool split_view(Split *root, View *view, View *new_view, bool vertical);
+
+/**
+ *  split_close(root, view)
+ *
+ *  Purpose:
+ *      This function removes 'view' from the layout at '*root' and free's
+ *      it, the other half of its split takes up its area. 'view' needs to
+ *      be loaded. The buffer of 'view' is free'd as well if no other view
+ *      shows it.
+ *  Return value:
+ *      View* - the view that should get the focus, which is not loaded
+ *      NULL - There are no views left, '*root' has been free'd
+ */
+View *split_close(Split **root, View *view);
+
+/**
+ *  split_layout(node, y, x, height, width, status)
+ *
+ *  Purpose:
+ *      This function divides the area at 'y'|'x' of size 'height'|'width'
+ *      between the views of 'node', every view gets a status line if
+ *      'status' is set.
+ *  Return value:
+ *      void
+ */
+void split_layout(Split *node, size_t y, size_t x, size_t height,
+                  size_t width, bool status);
+
+/**
+ *  split_views(node, views, max)
+ *
+ *  Purpose:
+ *      This function collects the views of 'node' from left to right and
+ *      top to bottom into 'views', which holds 'max' views.
+ *  Return value:
+ *      size_t - amount of views
+ */
+size_t split_views(Split *node, View **views, size_t max);
+
+/**
+ *  split_open_buffer(root, path, state)
+ *
+ *  Purpose:
+ *      This function looks for a view in 'root' (which may be NULL) that
+ *      shows the file at 'path'. If there is none, the file is read into a
+ *      new buffer. Note that this function is using printf to print an
+ *      error if occoured.
+ *  Return value:
+ *      NULL - The file could not be read
+ *      Buffer* - the buffer of the file
+ */
+Buffer *split_open_buffer(Split *root, const char *path, State *state);
+
+/**
+ *  split_free_buffer(root, buf)
+ *
+ *  Purpose:
+ *      This function free's 'buf' together with its path, unless a view
+ *      of 'root' still shows it.
+ *  Return value:
+ *      void
+ */
+void split_free_buffer(Split *root, Buffer *buf);
+
+/**
+ *  split_find(node, view)
+ *
+ *  Purpose:
+ *      This function looks up the node of 'view' in the tree 'node'.
+ *  Return value:
+ *      NULL - 'view' is not part of 'node'
+ *      Split* - the node of 'view'
+ */
+static Split *split_find(Split *node, View *view);
+
+/**
+ *  split_find_buffer(node, buf)
+ *
+ *  Purpose:
+ *      This function looks for a view in 'node' that shows 'buf'.
+ *  Return value:
+ *      NULL - No view shows 'buf'
+ *      View* - the first view showing 'buf'
+ */
+static View *split_find_buffer(Split *node, Buffer *buf);
+
+#endif // _VIEW_H_
@@ -0,0 +1,69 @@
+// Fuzz target for the buffer, every input is turned into file content and
+// a sequence of edits that are checked against the model (buffer_model.h).
+//
+// libFuzzer: configure with CC=clang --enable-fuzzing, then run
+//            tests/buffer_fuzz [corpus directory]
+// AFL:       afl-fuzz -i seeds -o findings -- tests/buffer_fuzz @@
+// Without --enable-fuzzing, every file given as an argument is run once.
+// Without arguments, randomly generated inputs are run (used by make check).
+
+#include <locale.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "buffer_model.h"
+
+#define FUZZ_RANDOM_INPUTS 2000
+#define FUZZ_MAX_INPUT 4096
+
+static char fuzz_path[4096];
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (fuzz_path[0] == '\0') {
+        if (setlocale(LC_ALL, "C.UTF-8") == NULL) {
+            setlocale(LC_ALL, "en_US.UTF-8");
+        }
+        const char *tmp = getenv("TMPDIR");
+        snprintf(fuzz_path, sizeof(fuzz_path), "%s/ped-fuzz-%d",
+                 tmp != NULL ? tmp : "/tmp", (int)getpid());
+    }
+
+    Source src = {.data = data, .size = size};
+    if (!model_run_case(&src, fuzz_path)) {
+        // Let the fuzzer know about it, the input is saved as a crash
+        abort();
+    }
+    return 0;
+}
+
+#ifndef PED_LIBFUZZER
+int main(int argc, char **argv) {
+    uint8_t data[FUZZ_MAX_INPUT];
+    for (int i = 1; i < argc; ++i) {
+        FILE *fp = fopen(argv[i], "rb");
+        if (fp == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        size_t size = fread(data, 1, sizeof(data), fp);
+        fclose(fp);
+        LLVMFuzzerTestOneInput(data, size);
+    }
+
+    if (argc <= 1) {
+        srand(1);
+        for (size_t i = 0; i < FUZZ_RANDOM_INPUTS; ++i) {
+            size_t size = rand() % sizeof(data);
+            for (size_t j = 0; j < size; ++j) {
+                data[j] = rand();
+            }
+            LLVMFuzzerTestOneInput(data, size);
+        }
+        printf("%d random inputs\n", FUZZ_RANDOM_INPUTS);
+    }
+    unlink(fuzz_path);
+    return 0;
+}
+#endif
@@ -0,0 +1,1226 @@
+#include "buffer_model.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+
+enum ModelOp {
+    OP_APPEND,
+    OP_DELETE,
+    OP_BACKSPACE,
+    OP_ENTER,
+    OP_INSERT_LINE,
+    OP_DOWN,
+    OP_UP,
+    OP_RIGHT,
+    OP_LEFT,
+    OP_WORD_NEXT,
+    OP_WORD_PREV,
+    OP_WORD_END,
+    OP_FIND_CHAR,
+    OP_LINE_START,
+    OP_LINE_END,
+    OP_GOTO_LINE,
+    OP_ROW_DOWN,
+    OP_ROW_UP,
+    OP_SUBSTITUTE,
+    OP_FOLLOW,
+    OP_ADD_CURSOR,
+    OP_ADD_CURSOR_LINES,
+    OP_CLEAR_CURSORS,
+    OP_CURSORS_APPEND,
+    OP_CURSORS_DELETE,
+    OP_CURSORS_BACKSPACE,
+    OP_CURSORS_ENTER,
+
+    OP_LENGTH
+};
+
+static const char *op_names[] = {
+    "append",           "delete",           "backspace",
+    "enter",            "insert_line",      "down",
+    "up",               "right",            "left",
+    "word_next",        "word_prev",        "word_end",
+    "find_char",        "line_start",       "line_end",
+    "goto_line",        "row_down",         "row_up",
+    "substitute",       "follow",           "add_cursor",
+    "add_cursor_lines", "clear_cursors",    "cursors_append",
+    "cursors_delete",   "cursors_backspace", "cursors_enter"};
+
+// Characters of generated content: ASCII of every word class, a tab (no
+// width), 2, 3 and 4 byte sequences and double width characters
+static const wint_t alphabet[] = {'a',    'b',    'c',    ' ',    '_',
+                                  '.',    '\t',   0x00E9, 0x4E2D, 0x1F600};
+#define ALPHABET_SIZE (sizeof(alphabet) / sizeof(alphabet[0]))
+// Patterns are made of fewer characters, so that they actually match
+#define PATTERN_ALPHABET_SIZE 4
+static const wint_t pattern_alphabet[PATTERN_ALPHABET_SIZE] = {'a', 'b', 0x00E9,
+                                                               0x4E2D};
+
+size_t source_next(Source *src, size_t n) {
+    if (n <= 1)
+        return 0;
+    if (src->data == NULL) {
+        // xorshift64*
+        src->seed ^= src->seed >> 12;
+        src->seed ^= src->seed << 25;
+        src->seed ^= src->seed >> 27;
+        return (src->seed * 0x2545F4914F6CDD1DULL >> 32) % n;
+    }
+
+    size_t value = 0;
+    for (size_t range = 1; range < n; range <<= 8) {
+        if (src->pos >= src->size) {
+            src->done = true;
+            return 0;
+        }
+        value = value << 8 | src->data[src->pos++];
+    }
+    return value % n;
+}
+
+static wint_t model_value(wint_t c) {
+    return c >= MODEL_INVALID ? 0xFFFD : c;
+}
+
+static int model_width(wint_t c) {
+    int width = wcwidth(model_value(c));
+    return width < 0 ? 1 : width;
+}
+
+static int model_class(wint_t c) {
+    c = model_value(c);
+    if (iswspace(c))
+        return 0;
+    if (iswalnum(c) || c == '_')
+        return 2;
+    return 1;
+}
+
+static size_t model_encode(wint_t c, char *out) {
+    if (c >= MODEL_INVALID) {
+        out[0] = c & 0xFF;
+        return 1;
+    }
+    if (c < 0x80) {
+        out[0] = c;
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = 0xC0 | c >> 6;
+        out[1] = 0x80 | (c & 0x3F);
+        return 2;
+    }
+    if (c < 0x10000) {
+        out[0] = 0xE0 | c >> 12;
+        out[1] = 0x80 | (c >> 6 & 0x3F);
+        out[2] = 0x80 | (c & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | c >> 18;
+    out[1] = 0x80 | (c >> 12 & 0x3F);
+    out[2] = 0x80 | (c >> 6 & 0x3F);
+    out[3] = 0x80 | (c & 0x3F);
+    return 4;
+}
+
+static wint_t model_random_char(Source *src, bool invalid) {
+    // Invalid bytes are rare, a byte that can never start a sequence and
+    // a lone continuation byte
+    if (invalid && source_next(src, 16) == 0)
+        return MODEL_INVALID | (source_next(src, 2) ? 0xFF : 0x80);
+    return alphabet[source_next(src, ALPHABET_SIZE)];
+}
+
+static void model_insert_char(ModelLine *lin, size_t x, wint_t c) {
+    lin->chars = realloc(lin->chars, (lin->size + 1) * sizeof(wint_t));
+    memmove(&lin->chars[x + 1], &lin->chars[x],
+            (lin->size - x) * sizeof(wint_t));
+    lin->chars[x] = c;
+    lin->size++;
+}
+
+static wint_t model_remove_char(ModelLine *lin, size_t x) {
+    wint_t c = lin->chars[x];
+    memmove(&lin->chars[x], &lin->chars[x + 1],
+            (lin->size - x - 1) * sizeof(wint_t));
+    lin->size--;
+    return c;
+}
+
+static void model_insert_line(Model *model, size_t index, const wint_t *chars,
+                              size_t size) {
+    memmove(&model->lines[index + 1], &model->lines[index],
+            (model->size - index) * sizeof(ModelLine));
+    ModelLine *lin = &model->lines[index];
+    lin->chars = malloc((size + 1) * sizeof(wint_t));
+    if (size > 0) {
+        memcpy(lin->chars, chars, size * sizeof(wint_t));
+    }
+    lin->size = size;
+    model->size++;
+}
+
+static void model_remove_line(Model *model, size_t index) {
+    free(model->lines[index].chars);
+    memmove(&model->lines[index], &model->lines[index + 1],
+            (model->size - index - 1) * sizeof(ModelLine));
+    model->size--;
+}
+
+static size_t model_chars(Model *model) {
+    size_t chars = 0;
+    for (size_t i = 0; i < model->size; ++i) {
+        chars += model->lines[i].size;
+    }
+    return chars;
+}
+
+static void model_free(Model *model) {
+    for (size_t i = 0; i < model->size; ++i) {
+        free(model->lines[i].chars);
+    }
+    model->size = 0;
+    free(model->cursors);
+    model->cursors = NULL;
+    model->cursor_count = 0;
+}
+
+// Cursor helpers, these follow buffer.c's documentation
+
+static void model_set_cursor_x(Model *model, size_t x) {
+    ModelLine *lin = &model->lines[model->cursor_y];
+    model->cursor_x = 0;
+    model->render_cursor_x = 0;
+    for (; model->cursor_x < x && model->cursor_x < lin->size;
+         model->cursor_x++) {
+        model->render_cursor_x += model_width(lin->chars[model->cursor_x]);
+    }
+}
+
+static void model_cursor_to_line(Model *model, size_t index) {
+    model->cursor_y = index < model->size ? index : model->size - 1;
+    model->cursor_x = 0;
+    model->render_cursor_x = 0;
+}
+
+static bool model_delete_char(Model *model, size_t x, size_t y) {
+    ModelLine *lin = &model->lines[y];
+    if (lin->size == 0 || x >= lin->size)
+        return false;
+    bool last = x > 0 && x == lin->size - 1;
+    wint_t c = model_remove_char(lin, x);
+    if (last) {
+        model->render_cursor_x -= model_width(c);
+        model->cursor_x--;
+    }
+    return true;
+}
+
+static bool model_move_render_cursor_x(Model *model, size_t x, int dir) {
+    ModelLine *lin = &model->lines[model->cursor_y];
+    if (x >= lin->size)
+        return false;
+    model->render_cursor_x += model_width(lin->chars[x]) * dir;
+    return true;
+}
+
+static size_t model_wrap(ModelLine *lin, size_t width, size_t *points) {
+    if (width == 0) {
+        width = 1;
+    }
+    size_t count = 1;
+    size_t col = 0;
+    points[0] = 0;
+    for (size_t i = 0; i < lin->size; ++i) {
+        int w = model_width(lin->chars[i]);
+        if (col + w > width && col > 0) {
+            points[count++] = i;
+            col = 0;
+        }
+        col += w;
+    }
+    return count;
+}
+
+static size_t model_wrap_row(size_t *points, size_t count, size_t x) {
+    size_t row = 0;
+    while (row + 1 < count && points[row + 1] <= x) {
+        row++;
+    }
+    return row;
+}
+
+// Motions, the position moves by one character at a time just like the
+// Motion of buffer.c
+
+static wint_t model_at(Model *model, ModelPos *p) {
+    ModelLine *lin = &model->lines[p->y];
+    return p->x < lin->size ? lin->chars[p->x] : WEOF;
+}
+
+static bool model_next(Model *model, ModelPos *p) {
+    wint_t c = model_at(model, p);
+    if (c == WEOF)
+        return false;
+    p->render_x += model_width(c);
+    p->x++;
+    return true;
+}
+
+static bool model_prev(Model *model, ModelPos *p) {
+    if (p->x == 0)
+        return false;
+    p->x--;
+    p->render_x -= model_width(model_at(model, p));
+    return true;
+}
+
+static bool model_forward(Model *model, ModelPos *p) {
+    if (model_next(model, p))
+        return true;
+    if (p->y + 1 >= model->size)
+        return false;
+    *p = (ModelPos){.y = p->y + 1};
+    return true;
+}
+
+static bool model_backward(Model *model, ModelPos *p) {
+    if (model_prev(model, p))
+        return true;
+    if (p->y == 0)
+        return false;
+    ModelLine *lin = &model->lines[p->y - 1];
+    *p = (ModelPos){.y = p->y - 1, .x = lin->size};
+    for (size_t i = 0; i < lin->size; ++i) {
+        p->render_x += model_width(lin->chars[i]);
+    }
+    return true;
+}
+
+static ModelPos model_start(Model *model) {
+    ModelLine *lin = &model->lines[model->cursor_y];
+    return (ModelPos){
+        .y = model->cursor_y,
+        .x = model->cursor_x < lin->size ? model->cursor_x : lin->size,
+        .render_x = model->render_cursor_x};
+}
+
+static void model_apply(Model *model, ModelPos *p) {
+    if (model_at(model, p) == WEOF) {
+        model_prev(model, p);
+    }
+    model->cursor_y = p->y;
+    model->cursor_x = p->x;
+    model->render_cursor_x = p->render_x;
+}
+
+static void model_word_next(Model *model) {
+    ModelPos p = model_start(model);
+    wint_t c = model_at(model, &p);
+    if (c != WEOF) {
+        int class = model_class(c);
+        while ((c = model_at(model, &p)) != WEOF && class != 0 &&
+               model_class(c) == class) {
+            model_next(model, &p);
+        }
+    }
+    while ((c = model_at(model, &p)) == WEOF || model_class(c) == 0) {
+        if (model->lines[p.y].size == 0 && p.y != model->cursor_y)
+            break;
+        if (!model_forward(model, &p))
+            break;
+    }
+    model_apply(model, &p);
+}
+
+static void model_word_prev(Model *model) {
+    ModelPos p = model_start(model);
+    if (!model_backward(model, &p))
+        return;
+    wint_t c;
+    while ((c = model_at(model, &p)) == WEOF || model_class(c) == 0) {
+        if (model->lines[p.y].size == 0)
+            break;
+        if (!model_backward(model, &p))
+            break;
+    }
+    if ((c = model_at(model, &p)) != WEOF) {
+        int class = model_class(c);
+        while (p.x > 0 &&
+               model_class(model->lines[p.y].chars[p.x - 1]) == class) {
+            model_prev(model, &p);
+        }
+    }
+    model_apply(model, &p);
+}
+
+static void model_word_end(Model *model) {
+    ModelPos p = model_start(model);
+    if (!model_forward(model, &p))
+        return;
+    wint_t c;
+    while ((c = model_at(model, &p)) == WEOF || model_class(c) == 0) {
+        if (!model_forward(model, &p))
+            break;
+    }
+    if ((c = model_at(model, &p)) != WEOF) {
+        int class = model_class(c);
+        ModelLine *lin = &model->lines[p.y];
+        while (p.x + 1 < lin->size &&
+               model_class(lin->chars[p.x + 1]) == class) {
+            model_next(model, &p);
+        }
+    }
+    model_apply(model, &p);
+}
+
+static bool model_find_char(Model *model, wint_t c) {
+    ModelPos p = model_start(model);
+    if (model_at(model, &p) == WEOF)
+        return false;
+    model_next(model, &p);
+    wint_t itr;
+    while ((itr = model_at(model, &p)) != WEOF && model_value(itr) != c) {
+        model_next(model, &p);
+    }
+    if (model_at(model, &p) == WEOF)
+        return false;
+    model_apply(model, &p);
+    return true;
+}
+
+static void model_row_down(Model *model, size_t width) {
+    ModelLine *lin = &model->lines[model->cursor_y];
+    size_t *points = malloc((lin->size + 1) * sizeof(size_t));
+    size_t rows = model_wrap(lin, width, points);
+    size_t row = model_wrap_row(points, rows, model->cursor_x);
+    if (row + 1 >= rows) {
+        if (model->cursor_y + 1 < model->size) {
+            model_cursor_to_line(model, model->cursor_y + 1);
+        }
+    } else {
+        size_t x = points[row + 1] + model->cursor_x - points[row];
+        size_t end = row + 2 < rows ? points[row + 2] : lin->size;
+        if (x >= end) {
+            x = end - 1;
+        }
+        model_set_cursor_x(model, x);
+    }
+    free(points);
+}
+
+static void model_row_up(Model *model, size_t width) {
+    ModelLine *lin = &model->lines[model->cursor_y];
+    size_t *points = malloc((lin->size + 1) * sizeof(size_t));
+    size_t rows = model_wrap(lin, width, points);
+    size_t row = model_wrap_row(points, rows, model->cursor_x);
+    if (row == 0 && model->cursor_y > 0) {
+        // Go to the last row of the previous line
+        model_cursor_to_line(model, model->cursor_y - 1);
+        lin = &model->lines[model->cursor_y];
+        points = realloc(points, (lin->size + 1) * sizeof(size_t));
+        rows = model_wrap(lin, width, points);
+        if (rows > 1) {
+            model_set_cursor_x(model, points[rows - 1]);
+        }
+    } else if (row > 0) {
+        size_t x = points[row - 1] + model->cursor_x - points[row];
+        if (x >= points[row]) {
+            x = points[row] - 1;
+        }
+        model_set_cursor_x(model, x);
+    }
+    free(points);
+}
+
+static size_t model_substitute(Model *model, size_t first, size_t last,
+                               const wint_t *pattern, size_t pattern_size,
+                               const wint_t *replacement,
+                               size_t replacement_size, bool global) {
+    size_t replaced = 0;
+    for (size_t y = first; y <= last; ++y) {
+        ModelLine *lin = &model->lines[y];
+        for (size_t x = 0; x + pattern_size <= lin->size;) {
+            if (memcmp(&lin->chars[x], pattern,
+                       pattern_size * sizeof(wint_t)) != 0) {
+                x++;
+                continue;
+            }
+            for (size_t i = 0; i < pattern_size; ++i) {
+                model_remove_char(lin, x);
+            }
+            for (size_t i = 0; i < replacement_size; ++i) {
+                model_insert_char(lin, x + i, replacement[i]);
+            }
+            x += replacement_size;
+            replaced++;
+            if (!global)
+                break;
+        }
+    }
+
+    ModelLine *lin = &model->lines[model->cursor_y];
+    if (replaced > 0) {
+        size_t x = model->cursor_x;
+        if (x >= lin->size) {
+            x = lin->size > 0 ? lin->size - 1 : 0;
+        }
+        model_set_cursor_x(model, x);
+    }
+    return replaced;
+}
+
+// Multiple cursors. The model applies an edit to one cursor after another,
+// starting at the last one, and moves the cursors behind every single
+// change. The buffer does all of them in one pass.
+
+static int model_cursor_compare(const void *a, const void *b) {
+    const ModelCursor *ca = a;
+    const ModelCursor *cb = b;
+    if (ca->y != cb->y)
+        return ca->y < cb->y ? -1 : 1;
+    if (ca->x != cb->x)
+        return ca->x < cb->x ? -1 : 1;
+    return 0;
+}
+
+// Sorts the cursors and removes duplicates, the primary flag survives
+static void model_cursors_sort(Model *model) {
+    qsort(model->cursors, model->cursor_count, sizeof(ModelCursor),
+          model_cursor_compare);
+    size_t count = 0;
+    for (size_t i = 0; i < model->cursor_count; ++i) {
+        ModelCursor *cursor = &model->cursors[i];
+        if (count > 0 &&
+            model_cursor_compare(&model->cursors[count - 1], cursor) == 0) {
+            model->cursors[count - 1].primary |= cursor->primary;
+            continue;
+        }
+        model->cursors[count++] = *cursor;
+    }
+    model->cursor_count = count;
+}
+
+static bool model_add_cursor(Model *model, size_t x, size_t y) {
+    if (y >= model->size)
+        return false;
+    size_t size = model->lines[y].size;
+    if (x >= (size > 0 ? size : 1))
+        return false;
+    if (x == model->cursor_x && y == model->cursor_y)
+        return true;
+    model->cursors = realloc(model->cursors, (model->cursor_count + 1) *
+                                                 sizeof(ModelCursor));
+    model->cursors[model->cursor_count++] = (ModelCursor){.x = x, .y = y};
+    model_cursors_sort(model);
+    return true;
+}
+
+static void model_cursors_begin(Model *model) {
+    size_t count = 0;
+    for (size_t i = 0; i < model->cursor_count; ++i) {
+        ModelCursor cursor = model->cursors[i];
+        if (cursor.y >= model->size)
+            continue;
+        size_t size = model->lines[cursor.y].size;
+        if (cursor.x >= size) {
+            cursor.x = size > 0 ? size - 1 : 0;
+        }
+        model->cursors[count++] = cursor;
+    }
+    model->cursors = realloc(model->cursors, (count + 1) * sizeof(ModelCursor));
+    model->cursors[count++] = (ModelCursor){
+        .x = model->cursor_x, .y = model->cursor_y, .primary = true};
+    model->cursor_count = count;
+    model_cursors_sort(model);
+}
+
+static void model_cursors_end(Model *model) {
+    model_cursors_sort(model);
+    size_t count = 0;
+    for (size_t i = 0; i < model->cursor_count; ++i) {
+        if (model->cursors[i].primary) {
+            model->cursor_y = model->cursors[i].y;
+            model_set_cursor_x(model, model->cursors[i].x);
+            continue;
+        }
+        model->cursors[count++] = model->cursors[i];
+    }
+    model->cursor_count = count;
+}
+
+// Moves every cursor of line 'y' at or behind 'x' (except 'skip') by
+// 'delta' characters, then onto the content of the line
+static void model_cursors_shift(Model *model, size_t y, size_t x, int delta,
+                                ModelCursor *skip) {
+    size_t size = model->lines[y].size;
+    for (size_t i = 0; i < model->cursor_count; ++i) {
+        ModelCursor *cursor = &model->cursors[i];
+        if (cursor == skip || cursor->y != y)
+            continue;
+        if (cursor->x >= x) {
+            cursor->x += delta;
+        }
+        if (cursor->x >= size) {
+            cursor->x = size > 0 ? size - 1 : 0;
+        }
+    }
+}
+
+static void model_cursors_append(Model *model, wint_t c) {
+    model_cursors_begin(model);
+    for (size_t i = model->cursor_count; i-- > 0;) {
+        ModelCursor *cursor = &model->cursors[i];
+        ModelLine *lin = &model->lines[cursor->y];
+        if (lin->size == 0) {
+            model_insert_char(lin, 0, c);
+            continue;
+        }
+        model_insert_char(lin, cursor->x + 1, c);
+        model_cursors_shift(model, cursor->y, cursor->x + 1, 1, cursor);
+        cursor->x++;
+    }
+    model_cursors_end(model);
+}
+
+static void model_cursors_delete(Model *model) {
+    model_cursors_begin(model);
+    for (size_t i = model->cursor_count; i-- > 0;) {
+        ModelCursor *cursor = &model->cursors[i];
+        ModelLine *lin = &model->lines[cursor->y];
+        if (cursor->x >= lin->size)
+            continue;
+        // Deleting the last character moves onto the new last one
+        bool last = cursor->x > 0 && cursor->x == lin->size - 1;
+        model_remove_char(lin, cursor->x);
+        model_cursors_shift(model, cursor->y, cursor->x + 1, -1, cursor);
+        if (last) {
+            cursor->x--;
+        }
+    }
+    model_cursors_end(model);
+}
+
+static void model_cursors_backspace(Model *model) {
+    model_cursors_begin(model);
+    for (size_t i = model->cursor_count; i-- > 0;) {
+        ModelCursor *cursor = &model->cursors[i];
+        if (cursor->x == 0)
+            continue;
+        model_remove_char(&model->lines[cursor->y], cursor->x - 1);
+        model_cursors_shift(model, cursor->y, cursor->x, -1, cursor);
+        cursor->x--;
+    }
+    model_cursors_end(model);
+}
+
+static void model_cursors_enter(Model *model) {
+    model_cursors_begin(model);
+    // Every line with a cursor gets a single new line below it
+    size_t inserted_y = model->size;
+    for (size_t i = model->cursor_count; i-- > 0;) {
+        size_t y = model->cursors[i].y;
+        if (y != inserted_y) {
+            model_insert_line(model, y + 1, NULL, 0);
+            for (size_t j = i + 1; j < model->cursor_count; ++j) {
+                model->cursors[j].y++;
+            }
+            inserted_y = y;
+        }
+        model->cursors[i].y = y + 1;
+        model->cursors[i].x = 0;
+    }
+    model_cursors_end(model);
+}
+
+// Comparing the buffer with the model
+
+static bool model_compare(Model *model, Buffer *buf, const char *op,
+                          size_t step) {
+    const char *error = NULL;
+    bool at_line = false;
+    size_t line = 0;
+    char *bytes = malloc(model_chars(model) * 4 + 4);
+
+    if (buf->size != model->size) {
+        error = "amount of lines differs";
+    } else if (buf->line_index[0] != buf->first_line ||
+               buf->line_index[buf->size - 1] != buf->last_line ||
+               buf->first_line->prev != NULL ||
+               buf->last_line->next != NULL) {
+        error = "first or last line is wrong";
+    }
+    for (; error == NULL && line < buf->size; ++line) {
+        Line *lin = buf->line_index[line];
+        ModelLine *m = &model->lines[line];
+        size_t len = 0;
+        for (size_t i = 0; i < m->size; ++i) {
+            len += model_encode(m->chars[i], bytes + len);
+        }
+
+        if (line + 1 < buf->size && (lin->next != buf->line_index[line + 1] ||
+                                     lin->next->prev != lin)) {
+            error = "linked list does not match the line index";
+        } else if (lin->capacity > 0 && lin->bytes > lin->capacity) {
+            error = "line is larger than its capacity";
+        } else if (lin->size != m->size) {
+            error = "amount of characters differs";
+        } else if (lin->bytes != len ||
+                   (len > 0 && memcmp(lin->data, bytes, len) != 0)) {
+            error = "content differs";
+        }
+        if (error != NULL) {
+            at_line = true;
+            break;
+        }
+    }
+    if (error == NULL) {
+        if (buf->cursor_x != model->cursor_x ||
+            buf->cursor_y != model->cursor_y ||
+            buf->render_cursor_x != model->render_cursor_x) {
+            error = "cursor differs";
+        } else if (buf->cursor_y >= buf->size) {
+            error = "cursor_y is out of bounds";
+        } else if (buf->cursor_x > 0 &&
+                   buf->cursor_x >= buf->line_index[buf->cursor_y]->size) {
+            error = "cursor_x is out of bounds";
+        } else if (buf->cursor_count != model->cursor_count) {
+            error = "amount of cursors differs";
+        }
+    }
+    for (size_t i = 0; error == NULL && i < buf->cursor_count; ++i) {
+        if (buf->cursors[i].x != model->cursors[i].x ||
+            buf->cursors[i].y != model->cursors[i].y) {
+            error = "additional cursor differs";
+        }
+    }
+    if (error == NULL) {
+        free(bytes);
+        return true;
+    }
+
+    fprintf(stderr, "step %zu (%s): %s", step, op, error);
+    if (at_line) {
+        fprintf(stderr, " at line %zu", line);
+    }
+    fprintf(stderr, "\n  buffer: %zu lines, cursor %zu|%zu render %zu\n",
+            buf->size, buf->cursor_x, buf->cursor_y, buf->render_cursor_x);
+    fprintf(stderr, "  model:  %zu lines, cursor %zu|%zu render %zu\n",
+            model->size, model->cursor_x, model->cursor_y,
+            model->render_cursor_x);
+    for (size_t i = 0; i < model->cursor_count || i < buf->cursor_count;
+         ++i) {
+        if (i < buf->cursor_count) {
+            fprintf(stderr, "  buffer cursor %zu|%zu", buf->cursors[i].x,
+                    buf->cursors[i].y);
+        }
+        if (i < model->cursor_count) {
+            fprintf(stderr, "  model cursor %zu|%zu", model->cursors[i].x,
+                    model->cursors[i].y);
+        }
+        fprintf(stderr, "\n");
+    }
+    for (size_t i = 0; i < model->size || i < buf->size; ++i) {
+        if (i < buf->size) {
+            Line *lin = buf->line_index[i];
+            fprintf(stderr, "  b%zu: '%.*s'\n", i, (int)lin->bytes, lin->data);
+        }
+        if (i < model->size) {
+            fprintf(stderr, "  m%zu: '", i);
+            for (size_t j = 0; j < model->lines[i].size; ++j) {
+                size_t len = model_encode(model->lines[i].chars[j], bytes);
+                fprintf(stderr, "%.*s", (int)len, bytes);
+            }
+            fprintf(stderr, "'\n");
+        }
+    }
+    free(bytes);
+    return false;
+}
+
+static bool model_write(const char *path, const char *mode,
+                        const wint_t *chars, size_t size) {
+    FILE *fp = fopen(path, mode);
+    if (fp == NULL)
+        return false;
+    char bytes[4];
+    for (size_t i = 0; i < size; ++i) {
+        fwrite(bytes, 1, model_encode(chars[i], bytes), fp);
+    }
+    return fclose(fp) == 0;
+}
+
+static void model_follow_line(Model *model, size_t partial) {
+    // The unterminated last line is replaced unless it has been edited
+    ModelLine *last = &model->lines[model->size - 1];
+    if (partial > 0 && last->size == partial &&
+        memcmp(last->chars, model->pending, partial * sizeof(wint_t)) == 0) {
+        model_remove_line(model, model->size - 1);
+    }
+    model_insert_line(model, model->size, model->pending,
+                      model->pending_size);
+}
+
+static void model_follow(Model *model, Source *src, Buffer *buf,
+                         char *path) {
+    // New lines (with an unterminated one at the end sometimes) are
+    // appended to the file
+    wint_t chars[MODEL_MAX_LINES * (MODEL_MAX_LINE_SIZE + 1)];
+    size_t size = 0;
+    size_t lines = source_next(src, 4);
+    bool unterminated = source_next(src, 2);
+    for (size_t i = 0; i < lines + unterminated; ++i) {
+        size_t len = source_next(src, MODEL_MAX_LINE_SIZE);
+        for (size_t j = 0; j < len; ++j) {
+            chars[size++] = model_random_char(src, true);
+        }
+        if (i < lines) {
+            chars[size++] = '\n';
+        }
+    }
+    model_write(path, "a", chars, size);
+
+    bool was_at_end = model->cursor_y + 1 >= model->size;
+    size_t old_size = model->size;
+    size_t partial = model->pending_size;
+    for (size_t i = 0; i < size; ++i) {
+        if (chars[i] != '\n') {
+            model->pending[model->pending_size++] = chars[i];
+            continue;
+        }
+        model_follow_line(model, partial);
+        model->pending_size = 0;
+        partial = 0;
+    }
+    if (model->pending_size > partial) {
+        model_follow_line(model, partial);
+    }
+    buffer_follow_update(buf);
+    if (model->size != old_size && was_at_end) {
+        model_cursor_to_line(model, model->size - 1);
+    }
+}
+
+bool model_run_case(Source *src, char *path) {
+    static Model model;
+    memset(&model, 0, sizeof(model));
+
+    // Generate the content of the file, a file ending with an empty line
+    // needs a trailing \n for the empty line to exist
+    wint_t chars[MODEL_MAX_LINES * (MODEL_MAX_LINE_SIZE + 1)];
+    size_t size = 0;
+    size_t lines = source_next(src, MODEL_MAX_LINES) + 1;
+    for (size_t i = 0; i < lines; ++i) {
+        size_t len = source_next(src, MODEL_MAX_LINE_SIZE);
+        for (size_t j = 0; j < len; ++j) {
+            chars[size++] = model_random_char(src, true);
+        }
+        model_insert_line(&model, model.size, &chars[size - len], len);
+        if (i + 1 < lines || len == 0 || source_next(src, 2)) {
+            chars[size++] = '\n';
+        } else {
+            memcpy(model.pending, &chars[size - len], len * sizeof(wint_t));
+            model.pending_size = len;
+        }
+    }
+    if (!model_write(path, "w", chars, size)) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        model_free(&model);
+        return false;
+    }
+
+    // With a limit of 1 byte, every file is mapped and keeps one block
+    State state = {.max_y = 10, .max_x = 20, .max_mem = source_next(src, 2)};
+    Buffer buf = {.state = &state};
+    bool ok = buffer_read_from_file(&buf, path);
+    if (!ok) {
+        fprintf(stderr, "Failed to read %s\n", path);
+    }
+    bool follow = ok && source_next(src, 2) && buffer_follow_start(&buf);
+    ok = ok && model_compare(&model, &buf, "read", 0);
+
+    size_t ops = source_next(src, MODEL_MAX_OPS);
+    for (size_t step = 1; ok && step <= ops && !src->done; ++step) {
+        enum ModelOp op = source_next(src, OP_LENGTH);
+        switch (op) {
+        case OP_APPEND: {
+            // like mode_handle_insert for any other key
+            wint_t c = model_random_char(src, false);
+            buffer_append_char_at_cursor(&buf, c);
+            ModelLine *lin = &model.lines[model.cursor_y];
+            if (lin->size == 0) {
+                model_insert_char(lin, 0, c);
+                break;
+            }
+            size_t x = model.cursor_x < lin->size ? model.cursor_x
+                                                  : lin->size - 1;
+            model_insert_char(lin, x + 1, c);
+            if (x == model.cursor_x) {
+                model.render_cursor_x += model_width(lin->chars[x]);
+                model.cursor_x++;
+            } else {
+                model_set_cursor_x(&model, x + 1);
+            }
+        } break;
+        case OP_DELETE: {
+            buffer_delete_char_at_cursor(&buf);
+            model_delete_char(&model, model.cursor_x, model.cursor_y);
+        } break;
+        case OP_BACKSPACE: {
+            // like mode_handle_insert for KEY_BACKSPACE
+            Line *lin = buffer_find_line(&buf, buf.cursor_y);
+            if (lin->size <= 0 && lin != buf.last_line &&
+                lin != buf.first_line) {
+                buffer_delete_line(&buf, lin);
+            } else if (buffer_delete_char_at_cursor_x(&buf,
+                                                      buf.cursor_x - 1)) {
+                if (buffer_move_render_cursor_x(&buf, buf.cursor_x - 1,
+                                                -1)) {
+                    buf.cursor_x--;
+                }
+            }
+
+            size_t y = model.cursor_y;
+            if (model.lines[y].size == 0 && y + 1 < model.size && y > 0) {
+                model_remove_line(&model, y);
+            } else if (model_delete_char(&model, model.cursor_x - 1, y)) {
+                if (model_move_render_cursor_x(&model, model.cursor_x - 1,
+                                               -1)) {
+                    model.cursor_x--;
+                }
+            }
+        } break;
+        case OP_ENTER: {
+            buffer_insert_line_at_cursor(&buf);
+            model_insert_line(&model, model.cursor_y + 1, NULL, 0);
+            model_cursor_to_line(&model, model.cursor_y + 1);
+        } break;
+        case OP_INSERT_LINE: {
+            // Lines are only inserted below the cursor, the cursor is not
+            // updated if its line moves
+            size_t y = model.cursor_y +
+                       source_next(src, model.size - model.cursor_y + 1);
+            buffer_insert_line_at_cursor_y(&buf, y);
+            if (y < model.size) {
+                model_insert_line(&model, y + 1, NULL, 0);
+            }
+        } break;
+        case OP_DOWN: {
+            buffer_move_cursor_down(&buf);
+            if (model.cursor_y + 1 < model.size) {
+                model_cursor_to_line(&model, model.cursor_y + 1);
+            }
+        } break;
+        case OP_UP: {
+            buffer_move_cursor_up(&buf);
+            if (model.cursor_y > 0) {
+                model_cursor_to_line(&model, model.cursor_y - 1);
+            }
+        } break;
+        case OP_RIGHT: {
+            buffer_move_cursor_right(&buf);
+            size_t lin_size = model.lines[model.cursor_y].size;
+            if (lin_size != 0 && model.cursor_x < lin_size - 1 &&
+                model.render_cursor_x < lin_size - 1 &&
+                model_move_render_cursor_x(&model, model.cursor_x, 1)) {
+                model.cursor_x++;
+            }
+        } break;
+        case OP_LEFT: {
+            buffer_move_cursor_left(&buf);
+            if (model.cursor_x > 0 && model.render_cursor_x > 0 &&
+                model_move_render_cursor_x(&model, model.cursor_x, -1)) {
+                model.cursor_x--;
+            }
+        } break;
+        case OP_WORD_NEXT: {
+            buffer_move_cursor_word_next(&buf);
+            model_word_next(&model);
+        } break;
+        case OP_WORD_PREV: {
+            buffer_move_cursor_word_prev(&buf);
+            model_word_prev(&model);
+        } break;
+        case OP_WORD_END: {
+            buffer_move_cursor_word_end(&buf);
+            model_word_end(&model);
+        } break;
+        case OP_FIND_CHAR: {
+            wint_t c = source_next(src, 8) == 0
+                           ? 0xFFFD
+                           : alphabet[source_next(src, ALPHABET_SIZE)];
+            bool found = buffer_move_cursor_find_char(&buf, c);
+            if (found != model_find_char(&model, c)) {
+                fprintf(stderr, "step %zu (find_char): result differs\n",
+                        step);
+                ok = false;
+            }
+        } break;
+        case OP_LINE_START: {
+            buffer_move_cursor_line_start(&buf);
+            model.cursor_x = 0;
+            model.render_cursor_x = 0;
+        } break;
+        case OP_LINE_END: {
+            buffer_move_cursor_line_end(&buf);
+            ModelPos p = model_start(&model);
+            while (model_next(&model, &p))
+                ;
+            model_apply(&model, &p);
+        } break;
+        case OP_GOTO_LINE: {
+            size_t y = source_next(src, model.size + 2);
+            buffer_move_cursor_to_line(&buf, y);
+            model_cursor_to_line(&model, y);
+        } break;
+        case OP_ROW_DOWN: {
+            size_t width = source_next(src, 8);
+            buffer_move_cursor_row_down(&buf, width);
+            model_row_down(&model, width);
+        } break;
+        case OP_ROW_UP: {
+            size_t width = source_next(src, 8);
+            buffer_move_cursor_row_up(&buf, width);
+            model_row_up(&model, width);
+        } break;
+        case OP_SUBSTITUTE: {
+            wint_t pattern[4] = {0};
+            wint_t replacement[5] = {0};
+            size_t pattern_size = source_next(src, 3) + 1;
+            // Replacements only grow the content while it is small
+            size_t replacement_size =
+                model_chars(&model) < MODEL_MAX_CHARS ? source_next(src, 4)
+                                                      : 0;
+            for (size_t i = 0; i < pattern_size; ++i) {
+                pattern[i] =
+                    pattern_alphabet[source_next(src, PATTERN_ALPHABET_SIZE)];
+            }
+            for (size_t i = 0; i < replacement_size; ++i) {
+                replacement[i] = model_random_char(src, false);
+            }
+            size_t first = source_next(src, model.size);
+            size_t last = first + source_next(src, model.size - first);
+            bool global = source_next(src, 2);
+
+            wchar_t wpattern[4] = {0};
+            wchar_t wreplacement[5] = {0};
+            for (size_t i = 0; i < 4; ++i) {
+                wpattern[i] = pattern[i];
+                wreplacement[i] = replacement[i];
+            }
+            size_t replaced = buffer_substitute(&buf, first, last, wpattern,
+                                                wreplacement, global);
+            if (replaced != model_substitute(&model, first, last, pattern,
+                                             pattern_size, replacement,
+                                             replacement_size, global)) {
+                fprintf(stderr, "step %zu (substitute): count differs\n",
+                        step);
+                ok = false;
+            }
+        } break;
+        case OP_FOLLOW: {
+            if (follow) {
+                model_follow(&model, src, &buf, path);
+            }
+        } break;
+        case OP_ADD_CURSOR: {
+            size_t y = source_next(src, model.size + 1);
+            size_t x = source_next(src, MODEL_MAX_LINE_SIZE);
+            if (buffer_add_cursor(&buf, x, y) !=
+                model_add_cursor(&model, x, y)) {
+                fprintf(stderr, "step %zu (add_cursor): result differs\n",
+                        step);
+                ok = false;
+            }
+        } break;
+        case OP_ADD_CURSOR_LINES: {
+            size_t first = source_next(src, model.size);
+            size_t last = first + source_next(src, model.size - first + 1);
+            size_t added = buffer_add_cursor_lines(&buf, first, last);
+            size_t count = model.cursor_count;
+            for (size_t y = first; y <= last && y < model.size; ++y) {
+                size_t size = model.lines[y].size;
+                size_t x = model.cursor_x;
+                if (x >= size) {
+                    x = size > 0 ? size - 1 : 0;
+                }
+                model_add_cursor(&model, x, y);
+            }
+            if (added != model.cursor_count - count) {
+                fprintf(stderr,
+                        "step %zu (add_cursor_lines): count differs\n", step);
+                ok = false;
+            }
+        } break;
+        case OP_CLEAR_CURSORS: {
+            buffer_clear_cursors(&buf);
+            model.cursor_count = 0;
+        } break;
+        case OP_CURSORS_APPEND: {
+            // Every cursor adds a character, the content stays small
+            if (model_chars(&model) < MODEL_MAX_CHARS) {
+                wint_t c = model_random_char(src, false);
+                buffer_cursors_append_char(&buf, c);
+                model_cursors_append(&model, c);
+            }
+        } break;
+        case OP_CURSORS_DELETE: {
+            buffer_cursors_delete_char(&buf);
+            model_cursors_delete(&model);
+        } break;
+        case OP_CURSORS_BACKSPACE: {
+            buffer_cursors_backspace(&buf);
+            model_cursors_backspace(&model);
+        } break;
+        case OP_CURSORS_ENTER: {
+            // Every line may get a new one, the model has a limited amount
+            if (model.size * 2 <= MODEL_MAX_LINES * MODEL_MAX_OPS) {
+                buffer_cursors_insert_line(&buf);
+                model_cursors_enter(&model);
+            }
+        } break;
+        case OP_LENGTH:
+            break;
+        }
+        ok = ok && model_compare(&model, &buf, op_names[op], step);
+    }
+
+    // Saving writes every line followed by a \n
+    if (ok) {
+        size_t cap = model_chars(&model) * 4 + model.size + 1;
+        char *expected = malloc(cap);
+        char *actual = malloc(cap);
+        size_t len = 0;
+        for (size_t i = 0; i < model.size; ++i) {
+            for (size_t j = 0; j < model.lines[i].size; ++j) {
+                len += model_encode(model.lines[i].chars[j], expected + len);
+            }
+            expected[len++] = '\n';
+        }
+        buffer_follow_stop(&buf);
+        if (source_next(src, 2)) {
+            ok = buffer_save(&buf, path);
+        } else if (buffer_save_start(&buf, path)) {
+            // The file has to be the buffer at the time of the save, no
+            // matter what happens to the buffer meanwhile
+            size_t edits = source_next(src, 8);
+            for (size_t i = 0; i < edits; ++i) {
+                Line *lin = buffer_find_line(&buf, buf.cursor_y);
+                switch (source_next(src, 4)) {
+                case 0: {
+                    buffer_append_char_at_cursor(&buf, 'x');
+                } break;
+                case 1: {
+                    buffer_insert_line_at_cursor(&buf);
+                } break;
+                case 2: {
+                    if (buffer_delete_line(&buf, lin)) {
+                        buf.cursor_y--;
+                        buf.cursor_x = 0;
+                    }
+                } break;
+                case 3: {
+                    // Changes lines the save is still writing
+                    buffer_substitute(&buf, 0, buf.size - 1, L"a", L"xy",
+                                      true);
+                    buffer_clamp_cursor(&buf);
+                } break;
+                }
+            }
+            ok = buffer_save_finish(&buf, true) == BUFFER_SAVE_DONE;
+        } else {
+            ok = false;
+        }
+        FILE *fp = fopen(path, "r");
+        size_t actual_len = fp != NULL ? fread(actual, 1, cap, fp) : 0;
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        if (!ok || actual_len != len || memcmp(actual, expected, len) != 0) {
+            fprintf(stderr, "save: written file differs\n");
+            ok = false;
+        }
+        free(expected);
+        free(actual);
+    }
+
+    buffer_free(&buf);
+    model_free(&model);
+    return ok;
+}
+
+bool model_run_join_cases(char *path) {
+    // Deleting the X leaves E2 82 AC, which is U+20AC
+    static const char content[] = "\xE2\x82X\xAC\nab\n";
+    static const char *names[] = {"join: delete", "join: backspace",
+                                  "join: cursors delete",
+                                  "join: cursors backspace",
+                                  "join: substitute"};
+    static const wint_t joined[] = {0x20AC};
+    static const wint_t line[] = {'a', 'b'};
+    static Model model;
+
+    bool ok = true;
+    for (size_t i = 0; ok && i < sizeof(names) / sizeof(names[0]); ++i) {
+        FILE *fp = fopen(path, "w");
+        if (fp == NULL)
+            return false;
+        fwrite(content, 1, sizeof(content) - 1, fp);
+        fclose(fp);
+
+        State state = {.max_y = 10, .max_x = 20};
+        Buffer buf = {.state = &state};
+        if (!buffer_read_from_file(&buf, path)) {
+            buffer_free(&buf);
+            return false;
+        }
+        memset(&model, 0, sizeof(model));
+        model_insert_line(&model, 0, joined, 1);
+
+        // Every invalid byte is one column wide, the cursor starts on the X
+        // or on the byte behind it
+        buf.cursor_x = i == 1 || i == 3 ? 3 : 2;
+        buf.render_cursor_x = buf.cursor_x;
+        switch (i) {
+        case 0: {
+            buffer_delete_char_at_cursor(&buf);
+        } break;
+        case 1: {
+            // like mode_handle_insert for KEY_BACKSPACE
+            if (buffer_delete_char_at_cursor_x(&buf, buf.cursor_x - 1) &&
+                buffer_move_render_cursor_x(&buf, buf.cursor_x - 1, -1)) {
+                buf.cursor_x--;
+            }
+        } break;
+        case 2: {
+            buffer_add_cursor(&buf, 0, 1);
+            buffer_cursors_delete_char(&buf);
+        } break;
+        case 3: {
+            buffer_add_cursor(&buf, 1, 1);
+            buffer_cursors_backspace(&buf);
+        } break;
+        case 4: {
+            buf.cursor_x = 0;
+            buf.render_cursor_x = 0;
+            buffer_substitute(&buf, 0, 0, L"X", L"", false);
+        } break;
+        }
+
+        // The cursors on the second line delete its 'a'
+        if (i == 2 || i == 3) {
+            model_insert_line(&model, 1, &line[1], 1);
+            model.cursors = calloc(1, sizeof(ModelCursor));
+            model.cursor_count = 1;
+            model.cursors[0].y = 1;
+        } else {
+            model_insert_line(&model, 1, line, 2);
+        }
+        ok = model_compare(&model, &buf, names[i], 0);
+        buffer_free(&buf);
+        model_free(&model);
+    }
+    return ok;
+}
@@ -0,0 +1,118 @@
+#ifndef _BUFFER_MODEL_H_
+#define _BUFFER_MODEL_H_
+
+#include "buffer.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+
+// Content of a generated test case stays small, so that comparing the whole
+// buffer after every edit is cheap
+#define MODEL_MAX_LINES 8
+#define MODEL_MAX_LINE_SIZE 12
+#define MODEL_MAX_OPS 200
+// Substitutions stop growing the content once it has this many characters
+#define MODEL_MAX_CHARS 1024
+
+// Invalid bytes are stored as MODEL_INVALID | byte, the buffer shows them as
+// U+FFFD but writes them back unchanged
+#define MODEL_INVALID 0x110000
+
+// Where the random decisions of a test case come from. With 'data' set,
+// every decision consumes the next bytes of 'data' (fuzzing), otherwise a
+// pseudo random generator seeded with 'seed' is used.
+typedef struct _Source_ {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    uint64_t seed;
+
+    // set once 'data' has been used up
+    bool done;
+} Source;
+
+typedef struct _ModelLine_ {
+    wint_t *chars;
+    size_t size;
+} ModelLine;
+
+// An additional cursor of the model, see Cursor in buffer.h. While an edit
+// is applied to every cursor, the primary cursor is part of the list too.
+typedef struct _ModelCursor_ {
+    size_t x;
+    size_t y;
+    bool primary;
+} ModelCursor;
+
+// The reference model, every line is a plain array of characters. The
+// model implements the documented behaviour of the buffer functions
+// (including the cursor quirks of the editor) without sharing any code
+// with buffer.c.
+typedef struct _Model_ {
+    ModelLine lines[MODEL_MAX_LINES * MODEL_MAX_OPS];
+    size_t size;
+
+    size_t cursor_x;
+    size_t cursor_y;
+    size_t render_cursor_x;
+
+    // sorted by position, just like the buffer's cursors
+    ModelCursor *cursors;
+    size_t cursor_count;
+
+    // Characters at the end of the file that are not terminated by a \n
+    // yet, they are shown as the last line (see Buffer.read_partial)
+    wint_t pending[MODEL_MAX_LINE_SIZE * MODEL_MAX_OPS];
+    size_t pending_size;
+} Model;
+
+// A position used by the model's motions, see Motion in buffer.h
+typedef struct _ModelPos_ {
+    size_t y;
+    size_t x;
+    size_t render_x;
+} ModelPos;
+
+/**
+ *  source_next(src, n)
+ *
+ *  Purpose:
+ *      This function takes the next random decision from 'src'.
+ *  Return value:
+ *      size_t - a number between 0 and 'n' - 1
+ */
+size_t source_next(Source *src, size_t n);
+
+/**
+ *  model_run_case(src, path)
+ *
+ *  Purpose:
+ *      This function generates file content and a sequence of edits from
+ *      'src'. The content is written to 'path' and read into a Buffer,
+ *      then every edit is applied to both the Buffer and the model. After
+ *      every edit, the content and the cursor of both are compared and the
+ *      invariants of the buffer are checked. The case ends by saving the
+ *      buffer and comparing the written file. Mismatches are described on
+ *      stderr.
+ *  Return value:
+ *      true - The buffer behaved like the model
+ *      false - A mismatch or a broken invariant was found
+ */
+bool model_run_case(Source *src, char *path);
+
+/**
+ *  model_run_join_cases(path)
+ *
+ *  Purpose:
+ *      This function checks every way of deleting a character between a
+ *      truncated lead byte and a continuation byte, which joins them into
+ *      a single character. The random cases never generate such bytes
+ *      since the model keeps every invalid byte a character on its own.
+ *  Return value:
+ *      true - The buffer counted the joined character correctly
+ *      false - A mismatch or a broken invariant was found
+ */
+bool model_run_join_cases(char *path);
+
+#endif // _BUFFER_MODEL_H_
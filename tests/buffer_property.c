@@ -0,0 +1,55 @@
+// Differential property test of the buffer, see buffer_model.h.
+//
+// Usage: buffer_property [cases] [seed]
+// A failing case prints its seed, running it again with that seed and a
+// single case reproduces it.
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "buffer_model.h"
+
+#define PROPERTY_CASES 2000
+
+int main(int argc, char **argv) {
+    // Wide characters are only measured correctly in a UTF-8 locale
+    if (setlocale(LC_ALL, "C.UTF-8") == NULL) {
+        setlocale(LC_ALL, "en_US.UTF-8");
+    }
+
+    size_t cases = argc > 1 ? strtoull(argv[1], NULL, 10) : PROPERTY_CASES;
+    unsigned long long seed = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+
+    const char *tmp = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/ped-property-XXXXXX",
+             tmp != NULL ? tmp : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    size_t failed = 0;
+    if (!model_run_join_cases(path)) {
+        fprintf(stderr, "joining invalid bytes failed\n\n");
+        failed++;
+    }
+    for (size_t i = 0; i < cases; ++i, ++seed) {
+        // xorshift needs a seed other than 0
+        Source src = {.seed = seed * 0x9E3779B97F4A7C15ULL | 1};
+        if (!model_run_case(&src, path)) {
+            fprintf(stderr, "case failed, reproduce with: %s 1 %llu\n\n",
+                    argv[0], seed);
+            if (++failed == 10)
+                break;
+        }
+    }
+    unlink(path);
+
+    printf("%zu cases, %zu failed\n", cases, failed);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,178 @@
+// Render benchmark, drives ped through a pseudo terminal.
+//
+// Usage: render_bench <ped> [lines] [keys]
+// A file of 'lines' lines (200000 by default) is opened in a 200x50
+// terminal and scrolled down by 'keys' presses of j (2000 by default),
+// starting once the first screen is drawn. Every key press is one frame,
+// the next key is only sent once the frame has been written. The CPU time
+// of ped and the bytes it writes to the terminal are measured for the
+// frames only, loading the file is not part of the result.
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define BENCH_LINES 200000
+#define BENCH_KEYS 2000
+#define BENCH_ROWS 50
+#define BENCH_COLS 200
+// a frame is complete once ped has been quiet for this long (ms)
+#define BENCH_QUIET 5
+// ped is given this long to read the file and draw the first screen (ms)
+#define BENCH_STARTUP 30000
+
+static size_t bench_drain(int fd, int first_timeout) {
+    char data[65536];
+    size_t total = 0;
+    int timeout = first_timeout;
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    while (poll(&pfd, 1, timeout) > 0) {
+        ssize_t n = read(fd, data, sizeof(data));
+        if (n <= 0)
+            break;
+        total += n;
+        timeout = BENCH_QUIET;
+    }
+    return total;
+}
+
+static double bench_cpu_time(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    // utime and stime are the 14th and 15th field, the name in the second
+    // field is in parentheses and may contain spaces
+    char line[1024];
+    size_t len = fread(line, 1, sizeof(line) - 1, fp);
+    fclose(fp);
+    line[len] = '\0';
+    char *itr = strrchr(line, ')');
+    unsigned long utime = 0;
+    unsigned long stime = 0;
+    if (itr == NULL || sscanf(itr + 2,
+                              "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                              "%lu %lu",
+                              &utime, &stime) != 2)
+        return -1;
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static bool bench_write_file(const char *path, size_t lines) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        return false;
+    // Lines of varying length, some of them wider than the terminal
+    static const char words[] = "lorem ipsum dolor sit amet consectetur "
+                                "adipiscing elit sed do eiusmod tempor ";
+    for (size_t i = 0; i < lines; ++i) {
+        size_t len = (i * 7919) % (BENCH_COLS + BENCH_COLS / 2);
+        fprintf(fp, "%zu ", i);
+        for (size_t j = 0; j < len; ++j) {
+            putc(words[(i + j) % (sizeof(words) - 1)], fp);
+        }
+        putc('\n', fp);
+    }
+    return fclose(fp) == 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <ped> [lines] [keys]\n", argv[0]);
+        return 1;
+    }
+    size_t lines = argc > 2 ? strtoull(argv[2], NULL, 10) : BENCH_LINES;
+    size_t keys = argc > 3 ? strtoull(argv[3], NULL, 10) : BENCH_KEYS;
+
+    const char *tmp = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/ped-bench-XXXXXX",
+             tmp != NULL ? tmp : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    if (!bench_write_file(path, lines)) {
+        perror(path);
+        unlink(path);
+        return 1;
+    }
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        perror("posix_openpt");
+        unlink(path);
+        return 1;
+    }
+    struct winsize size = {.ws_row = BENCH_ROWS, .ws_col = BENCH_COLS};
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        unlink(path);
+        return 1;
+    }
+    if (pid == 0) {
+        setsid();
+        int slave = open(ptsname(master), O_RDWR);
+        if (slave < 0)
+            _exit(127);
+        ioctl(slave, TIOCSCTTY, 0);
+        ioctl(slave, TIOCSWINSZ, &size);
+        dup2(slave, STDIN_FILENO);
+        dup2(slave, STDOUT_FILENO);
+        dup2(slave, STDERR_FILENO);
+        close(slave);
+        close(master);
+        setenv("TERM", "xterm-256color", 1);
+        unsetenv("LINES");
+        unsetenv("COLUMNS");
+        execl(argv[1], argv[1], path, (char *)NULL);
+        _exit(127);
+    }
+
+    // Waiting for the first screen, whatever ped writes until it is idle
+    bench_drain(master, BENCH_STARTUP);
+    double start = bench_cpu_time(pid);
+    size_t bytes = 0;
+    size_t frames = 0;
+    for (; frames < keys; ++frames) {
+        if (write(master, "j", 1) != 1)
+            break;
+        size_t n = bench_drain(master, 1000);
+        if (n == 0)
+            break;
+        bytes += n;
+    }
+    double cpu = bench_cpu_time(pid) - start;
+
+    if (write(master, "\x11", 1) != 1) {
+        kill(pid, SIGTERM);
+    }
+    bench_drain(master, 1000);
+    int status;
+    waitpid(pid, &status, 0);
+    close(master);
+    unlink(path);
+
+    if (frames == 0 || start < 0) {
+        fprintf(stderr, "ped did not draw any frames\n");
+        return 1;
+    }
+    printf("%zu frames, %.3f s CPU\n", frames, cpu);
+    if (cpu > 0) {
+        printf("%.0f frames/s\n", frames / cpu);
+    }
+    printf("%.0f bytes/frame\n", (double)bytes / frames);
+    return frames == keys ? 0 : 1;
+}